@@ -6,7 +6,9 @@ class Console : public CrabbyGraphics
 private:
     struct sSpaceship
     {
-        triangle tShip;
+        vec_2d<float> vecModel[3]; // corners around the ship's middle
+        vec_2d<float> pPosition;
+        triangle tShip; // where it's drawn this frame
         float speed;
         float fAngle;
     } sShip;
@@ -34,9 +36,8 @@ public:
 
     bool Setup() override
     {
-        // Construct and move ship to the center of the screen
-        sShip = { {{4,0}, {0, 10}, {8, 10} }, 0.0f, 0.0f };
-        TranslateTriangle({ ScreenWidth() / 2, ScreenHeight() / 2 }, sShip.tShip, sShip.tShip);
+        // Construct ship at the center of the screen
+        sShip = { { {0.0f, -6.0f}, {-4.0f, 4.0f}, {4.0f, 4.0f} }, { ScreenWidth() / 2 + 4.0f, ScreenHeight() / 2 + 6.0f }, triangle(), 0.0f, 0.0f };
 
         SpawnAsteroids();
 
@@ -49,6 +50,28 @@ public:
 
         HandleInput();
 
+        // Move ship, the position is kept in floats so small steps add up
+        sShip.pPosition += vec_2d<float>(-sShip.speed * sin(sShip.fAngle) * fElapsedTime * 50.0f, sShip.speed * cos(sShip.fAngle) * fElapsedTime * 50.0f);
+
+        // If out of screen, bring back
+        if (sShip.pPosition.x > ScreenWidth())
+            sShip.pPosition.x -= ScreenWidth();
+        if (sShip.pPosition.x < 0)
+            sShip.pPosition.x += ScreenWidth();
+        if (sShip.pPosition.y > ScreenHeight())
+            sShip.pPosition.y -= ScreenHeight();
+        if (sShip.pPosition.y < 0)
+            sShip.pPosition.y += ScreenHeight();
+
+        // Rotate and place the ship's corners, rounding them to cells only to draw
+        vec_2d<float> vecShip[3];
+        PushMatrix();
+        Translate(sShip.pPosition.x, sShip.pPosition.y);
+        Rotate(sShip.fAngle);
+        TransformPoints(sShip.vecModel, vecShip, 3);
+        PopMatrix();
+        sShip.tShip = triangle(SnapPoint(vecShip[0]), SnapPoint(vecShip[1]), SnapPoint(vecShip[2]), FG_GREEN);
+
         // Check for asteroid-ship collisions
         // If true, reset game
         for (auto& asteroid : vecAsteroids)
@@ -99,30 +122,9 @@ public:
             DrawCircle(asteroid.pCenter, asteroid.radius);
         }
 
-        // Draw player (ship)
-        vec_2d vec_translation{ (-sShip.speed * sin(sShip.fAngle) * fElapsedTime * 50.0f), (sShip.speed * cos(sShip.fAngle) * fElapsedTime * 50.0f) };
-        TranslateTriangle(vec_translation, sShip.tShip, sShip.tShip);
-
-        // If out of screen, bring back
-        point_2d mp = sShip.tShip.midpoint();
-        if (mp.x > ScreenWidth())
-            TranslateTriangle(vec_2d{ -ScreenWidth(), 0 }, sShip.tShip, sShip.tShip);
-        if (mp.x < 0)
-            TranslateTriangle(vec_2d{ ScreenWidth(), 0 }, sShip.tShip, sShip.tShip);
-        if (mp.y > ScreenHeight())
-            TranslateTriangle(vec_2d{ 0, -ScreenHeight() }, sShip.tShip, sShip.tShip);
-        if (mp.y < 0)
-            TranslateTriangle(vec_2d{ 0, ScreenHeight() }, sShip.tShip, sShip.tShip);
-
-        // Rotate ship
-        triangle triRotated;
-        triRotated.fillColor = FG_GREEN;
-        RotateTriangle(sShip.tShip.midpoint(), sShip.fAngle, triRotated, sShip.tShip);
-
-        // Draw ship
-        DrawTriangle(triRotated);
-        FillTriangle(triRotated);
-        Pixelate(triRotated.midpoint(), FG_RED);
+        // Draw player (ship), filled and outlined in one go
+        FillTriangle(sShip.tShip);
+        Pixelate(SnapPoint(sShip.pPosition), FG_RED);
 
         // If there's no asteroids, create more!!
         if(!vecAsteroids.size())
@@ -151,7 +153,7 @@ public:
         if (m_keys[VK_SPACE].bPressed)
         {
             sBomb b;
-            b.p = { (float)sShip.tShip.midpoint().x, (float)sShip.tShip.midpoint().y};
+            b.p = sShip.pPosition;
             b.speed = -2.5f;
             b.fAngle = sShip.fAngle;
 
@@ -169,7 +171,7 @@ public:
         {
             here:
             int x, y;
-            point_2d pShipCoord = sShip.tShip.midpoint();
+            point_2d pShipCoord = SnapPoint(sShip.pPosition);
             x = ScreenWidth() * Random();
             y = ScreenHeight() * Random();
             int r = Random(2, 8);
@@ -196,17 +198,234 @@ public:
         return ((c.x - p.x)* (c.x - p.x) + (c.y - p.y) * (c.y - p.y)) <= r * r;
     }
 
+    // Draws rectangles, clipped and not, and checks every cell against what they
+    // should cover, without and with tiled rendering. Returns the number of wrong cells
+    int SelfTest()
+    {
+        int nBad = 0;
+        int W = ScreenWidth(), H = ScreenHeight();
+
+        auto Check = [&](const wchar_t* sName, auto expected) {
+            FlushTiles();
+            int n = 0;
+            for (int y = 0; y < H; y++)
+                for (int x = 0; x < W; x++)
+                    if (GetCell(x, y).Attributes != expected(x, y))
+                        n++;
+            std::wcout << L"  " << sName << L": " << (n ? std::to_wstring(n) + L" wrong cells" : L"ok") << std::endl;
+            nBad += n;
+        };
+
+        auto Inside = [](int x, int y, int x1, int y1, int x2, int y2) {
+            return x >= x1 && x < x2 && y >= y1 && y < y2;
+        };
+
+        for (int nThreads : { 0, 2 })
+        {
+            SetTiledRendering(nThreads);
+            std::wcout << (nThreads ? L"Tiled" : L"Serial") << std::endl;
+
+            // Fills of whole rows are drawn as one span, narrower ones row by row
+            ClearScreen();
+            Fill({ 0, 0 }, { W, H }, FG_RED);
+            Check(L"Fill whole screen", [&](int, int) { return FG_RED; });
+
+            ClearScreen();
+            Fill({ 0, 10 }, { W, 20 }, FG_RED);
+            Check(L"Fill full width rows", [&](int x, int y) { return Inside(x, y, 0, 10, W, 20) ? FG_RED : FG_BLACK; });
+
+            ClearScreen();
+            Fill({ -10, 30 }, { W + 10, 45 }, FG_RED);
+            Check(L"Fill past both sides", [&](int x, int y) { return Inside(x, y, 0, 30, W, 45) ? FG_RED : FG_BLACK; });
+
+            ClearScreen();
+            Fill({ 5, 5 }, { 152, 80 }, FG_RED);
+            Check(L"Fill inside", [&](int x, int y) { return Inside(x, y, 5, 5, 152, 80) ? FG_RED : FG_BLACK; });
+
+            // ClearScreen under a clip only clears the clip, like a HUD strip
+            Fill({ 0, 0 }, { W, H }, FG_WHITE);
+            PushClip({ 0, 10 }, { W, 20 });
+            ClearScreen();
+            PopClip();
+            Check(L"Clear full width clip", [&](int x, int y) { return Inside(x, y, 0, 10, W, 20) ? FG_BLACK : FG_WHITE; });
+
+            Fill({ 0, 0 }, { W, H }, FG_WHITE);
+            PushClip({ 20, 15 }, { 90, 60 });
+            PushClip({ 40, 5 }, { W + 5, 50 });
+            ClearScreen();
+            Fill({ 0, 0 }, { W, H }, FG_RED);
+            PopClip();
+            PopClip();
+            Check(L"Clear and fill nested clips", [&](int x, int y) { return Inside(x, y, 40, 15, 90, 50) ? FG_RED : FG_WHITE; });
+        }
+
+        SetTiledRendering(0);
+        return nBad;
+    }
+
+    // Times the engine's primitives on their own, outside of the game
+    void Bench()
+    {
+        auto Time = [](int nIterations, auto draw) {
+            auto tp1 = std::chrono::steady_clock::now();
+            for (int i = 0; i < nIterations; i++)
+                draw(i);
+            std::chrono::duration<double> elapsedTime = std::chrono::steady_clock::now() - tp1;
+            return elapsedTime.count() / nIterations;
+        };
+
+        int W = ScreenWidth(), H = ScreenHeight();
+        std::wcout << W << L"x" << H << std::endl;
+
+        double t = Time(200000, [&](int) { ClearScreen(); });
+        std::wcout << L"ClearScreen: " << t * 1000000.0 << L" us" << std::endl;
+
+        t = Time(200000, [&](int) { Fill({ 6, 7 }, { W - 7, H - 8 }, FG_RED); });
+        std::wcout << L"Fill " << W - 13 << L"x" << H - 15 << L": " << t * 1000000.0 << L" us" << std::endl;
+
+        // 1024 random triangles around the screen for each largest extent, drawn
+        // the old way, then with edge functions with and without the raster cache
+        const int nSizes[] = { 4, 16, 48, 128 };
+        std::vector<point_2d> vecPoints[4];
+        double tBoundingBox[4], tEdges[4], tUncached[4];
+        for (int s = 0; s < 4; s++)
+        {
+            for (int i = 0; i < 1024; i++)
+            {
+                point_2d p = { Random(0, W - 1), Random(0, H - 1) };
+                vecPoints[s].push_back(p);
+                vecPoints[s].push_back({ p.x + Random(-nSizes[s], nSizes[s]), p.y + Random(-nSizes[s], nSizes[s]) });
+                vecPoints[s].push_back({ p.x + Random(-nSizes[s], nSizes[s]), p.y + Random(-nSizes[s], nSizes[s]) });
+            }
+        }
+
+        auto TimeTriangles = [&](int s, int nPasses, bool bBoundingBox) {
+            const std::vector<point_2d>& v = vecPoints[s];
+            return Time(nPasses, [&](int n) {
+                for (int i = 0; i < 1024; i++)
+                {
+                    COLOR color = (COLOR)(1 + (n + i) % 14);
+                    if (bBoundingBox)
+                        FillTriangleBoundingBox(v[3 * i], v[3 * i + 1], v[3 * i + 2], color);
+                    else
+                        FillTriangle(v[3 * i], v[3 * i + 1], v[3 * i + 2], color);
+                }
+            }) / 1024;
+        };
+
+        for (int s = 0; s < 4; s++)
+        {
+            tBoundingBox[s] = TimeTriangles(s, 10, true);
+            tEdges[s] = TimeTriangles(s, 200, false);
+        }
+
+        SetRasterCacheSize(0);
+        for (int s = 0; s < 4; s++)
+            tUncached[s] = TimeTriangles(s, 200, false);
+
+        std::wcout << L"FillTriangle, triangles/s - bounding box / edge functions / uncached" << std::endl;
+        for (int s = 0; s < 4; s++)
+            std::wcout << L"  size " << nSizes[s] << L": " << (long long)(1 / tBoundingBox[s]) << L" / " << (long long)(1 / tEdges[s]) << L" / " << (long long)(1 / tUncached[s]) << std::endl;
+    }
+
+    // FillTriangle as it was before edge functions, kept to compare against in
+    // Bench. Every cell of the bounding box is tested by comparing float areas,
+    // the few inside go through the engine's public calls
+    void FillTriangleBoundingBox(const point_2d& p1, const point_2d& p2, const point_2d& p3, COLOR color)
+    {
+        auto Area = [](const point_2d& a, const point_2d& b, const point_2d& c) {
+            return (float)std::abs((a.x * (b.y - c.y) + b.x * (c.y - a.y) + c.x * (a.y - b.y)) / 2.0);
+        };
+
+        int x1 = (std::max)((std::min)((std::min)(p1.x, p2.x), p3.x), 0);
+        int y1 = (std::max)((std::min)((std::min)(p1.y, p2.y), p3.y), 0);
+        int x2 = (std::min)((std::max)((std::max)(p1.x, p2.x), p3.x), ScreenWidth() - 1);
+        int y2 = (std::min)((std::max)((std::max)(p1.y, p2.y), p3.y), ScreenHeight() - 1);
+
+        float fArea = Area(p1, p2, p3);
+        for (int y = y1; y <= y2; y++)
+        {
+            for (int x = x1; x <= x2; x++)
+            {
+                point_2d p = { x, y };
+                if (fArea == Area(p, p2, p3) + Area(p1, p, p3) + Area(p1, p2, p) && GetCell(x, y).Attributes != FG_WHITE)
+                    Pixelate(p, color);
+            }
+        }
+    }
+
     ~Console()
     {
     }
 };
 
-int main()
+int main(int argc, char* argv[])
 {
     Console console;
 
+    // Asteroids --headless <frames> [seed] [recording.cgr]
+    // Runs a scripted game without a console at a fixed 60 Hz step, for benchmarks and regression checks
+    if (argc > 2 && std::string(argv[1]) == "--headless")
+    {
+        int nFrames = std::stoi(argv[2]);
+        console.SetRandomSeed(argc > 3 ? std::stoul(argv[3]) : 1);
+        console.ConstructHeadless(160, 90);
+        if (argc > 4)
+            console.StartRecording(argv[4]);
+
+        auto tp1 = std::chrono::steady_clock::now();
+        int nFramesRun = console.RunHeadless(nFrames, 1.0f / 60.0f, [&](int nFrame) {
+            // Fly around in circles and keep shooting
+            console.SetKeyState(VK_UP, (nFrame / 120) % 2 == 0);
+            console.SetKeyState(VK_RIGHT, true);
+            console.SetKeyState(VK_SPACE, nFrame % 15 == 0);
+        });
+        std::chrono::duration<double> elapsedTime = std::chrono::steady_clock::now() - tp1;
+
+        std::wcout << nFramesRun << L" frames in " << elapsedTime.count() << L"s (" << nFramesRun / elapsedTime.count() << L" FPS), checksum " << std::hex << console.GetFrameChecksum() << std::endl;
+
+        sFrameStats update = console.GetFrameStats(PHASE_UPDATE);
+        std::wcout << std::dec << L"Update ms - p50: " << update.fP50 * 1000.0f << L" p95: " << update.fP95 * 1000.0f << L" p99: " << update.fP99 * 1000.0f << L" max: " << update.fMax * 1000.0f << std::endl;
+
+        sRasterCacheStats cache = console.GetRasterCacheStats();
+        std::wcout << L"Raster cache - hits: " << cache.nHits << L" misses: " << cache.nMisses << L" evictions: " << cache.nEvictions << L" entries: " << cache.nEntries << std::endl;
+        return 0;
+    }
+
+    // --selftest checks what the engine draws cell by cell, exits with 1 if anything is wrong
+    if (argc > 1 && std::string(argv[1]) == "--selftest")
+    {
+        console.ConstructHeadless(160, 90);
+        return console.SelfTest() ? 1 : 0;
+    }
+
+    // --bench times the engine's draw functions
+    if (argc > 1 && std::string(argv[1]) == "--bench")
+    {
+        console.SetRandomSeed(1);
+        console.ConstructHeadless(160, 90);
+        console.Bench();
+        return 0;
+    }
+
+    // --telemetry <file.csv> streams per frame timings while playing
+    if (argc > 2 && std::string(argv[1]) == "--telemetry")
+        console.StartTelemetryCSV(argv[2]);
+
+    console.SetFramePacing(PACING_FIXED, 60.0f);
+
     if (console.ConstructConsole(160, 90, 4, 4))
+    {
+        // --record <file.cgr> records the game for the Recording Player
+        if (argc > 2 && std::string(argv[1]) == "--record")
+            console.StartRecording(argv[2]);
+
+        // --share <name> publishes frames to shared memory for external viewers
+        if (argc > 2 && std::string(argv[1]) == "--share" && !console.StartFrameExport(argv[2]))
+            return 1;
+
         console.Start();
+    }
     else
         std::wcout << L"Select a different screen resolution/font dimension." << std::endl;
 
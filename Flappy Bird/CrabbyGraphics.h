@@ -10,9 +10,52 @@
 #include <chrono>
 #include <functional>
 #include <condition_variable>
+#include <string>
+#include <cstring>
+#include <memory>
+#include <unordered_map>
+#include <list>
+#ifdef _WIN32
 #include <windows.h>
+#pragma comment(lib, "winmm.lib")
+#else
+#include <csignal>
+#include <cerrno>
+#include <unistd.h>
+#include <termios.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 #include "Random.h"
 
+#ifndef _WIN32
+// There is no console API outside of Windows, so the framebuffer keeps the
+// CHAR_INFO layout and the VT backend translates it when presenting
+typedef struct _CHAR_INFO {
+	union {
+		wchar_t UnicodeChar;
+		char AsciiChar;
+	} Char;
+	unsigned short Attributes;
+} CHAR_INFO;
+
+// Virtual key codes used by the games (same values as winuser.h)
+#define VK_BACK 0x08
+#define VK_TAB 0x09
+#define VK_RETURN 0x0D
+#define VK_SHIFT 0x10
+#define VK_CONTROL 0x11
+#define VK_ESCAPE 0x1B
+#define VK_SPACE 0x20
+#define VK_LEFT 0x25
+#define VK_UP 0x26
+#define VK_RIGHT 0x27
+#define VK_DOWN 0x28
+#endif
+
 enum COLOR
 {
 	FG_BLACK = 0x0000,
@@ -57,165 +100,2247 @@ enum PIXEL_TYPE
 	PIXEL_QUARTER = 0x2591,
 };
 
-class CrabbyGraphics
+enum FRAME_PACING
 {
-private:
-	int m_screenWidth;
-	int m_screenHeight;
-	HANDLE m_hConsole;
-	HANDLE m_hConsoleInput;
-	HANDLE m_hOriginalConsole;
-	SMALL_RECT m_rectWindow; 
-	bool m_bIsConsoleInFocus = true;
+	PACING_UNCAPPED,	// Run frames back to back
+	PACING_FIXED,		// Sleep until the next frame of the target rate is due
+};
 
-	short m_keyOldState[256] = { 0 };
-	short m_keyNewState[256] = { 0 };
-	int m_mousePosX;
-	int m_mousePosY;
+// Fixed size single producer / single consumer queue. Neither side ever
+// blocks or allocates, Push fails when the queue is full
+template <typename T, size_t N>
+class SPSCQueue
+{
+	static_assert((N & (N - 1)) == 0, "SPSCQueue size must be a power of two");
 
-	// static thread variables - to handle window closing event
-	static std::mutex m_muxGame;
-	static std::condition_variable m_cvConditionVariable;
-	static std::atomic<bool> m_bIsRunning;
+	std::unique_ptr<T[]> m_items{ new T[N] };
+	std::atomic<size_t> m_nHead{ 0 };	// next item to pop, only written by the consumer
+	std::atomic<size_t> m_nTail{ 0 };	// next free slot, only written by the producer
 
-	void GameThread()
+public:
+	bool Push(const T& item)
 	{
-		if (!Setup())
-			m_bIsRunning = false;
+		size_t tail = m_nTail.load(std::memory_order_relaxed);
+		if (tail - m_nHead.load(std::memory_order_acquire) == N)
+			return false;
+
+		m_items[tail & (N - 1)] = item;
+		m_nTail.store(tail + 1, std::memory_order_release);
+		return true;
+	}
 
-		auto dt1 = std::chrono::system_clock::now();
-		auto dt2 = std::chrono::system_clock::now();
+	bool Pop(T& item)
+	{
+		size_t head = m_nHead.load(std::memory_order_relaxed);
+		if (head == m_nTail.load(std::memory_order_acquire))
+			return false;
 
-		while (m_bIsRunning)
+		item = m_items[head & (N - 1)];
+		m_nHead.store(head + 1, std::memory_order_release);
+		return true;
+	}
+};
+
+enum INPUT_EVENT
+{
+	EVENT_KEY,			// nCode is a virtual key code
+	EVENT_MOUSE_BUTTON,	// nCode is the mouse button, 0 left, 1 right, 2 middle
+	EVENT_MOUSE_MOVE,
+	EVENT_FOCUS,
+};
+
+// Raw input as collected by the input thread, turned into key and mouse
+// states by the game thread at the start of every frame
+struct sInputEvent
+{
+	INPUT_EVENT type;
+	int nCode;
+	bool bDown;			// key/button pressed, or console gained focus
+	int x, y;			// mouse position
+	std::chrono::steady_clock::time_point tp;
+};
+
+// Parts of a frame measured by the telemetry, in seconds
+enum FRAME_PHASE
+{
+	PHASE_INPUT,	// Reading the console input and updating key/mouse states
+	PHASE_UPDATE,	// The game's Update, which includes all of its drawing
+	PHASE_SUBMIT,	// Handing the frame to the present thread (waiting for a free buffer, copying the frame)
+	PHASE_PRESENT,	// Writing the frame to the console, on the present thread
+	PHASE_FRAME,	// Time between the start of this frame and the previous one
+	PHASE_COUNT,
+};
+
+struct sFrameTiming
+{
+	long long nFrame;
+	float fPhase[PHASE_COUNT];
+};
+
+struct sFrameStats
+{
+	float fP50, fP95, fP99, fMax;
+	int nFrames;		// number of frames the stats were taken over
+};
+
+struct sRasterCacheStats
+{
+	long long nHits, nMisses, nEvictions;
+	int nEntries;
+};
+
+// Cells written during a frame, kept as one span per row
+struct sDirtyRegion
+{
+	std::vector<int> vecMinX;	// first written column of each row
+	std::vector<int> vecMaxX;	// last written column of each row, -1 if untouched
+	int nMinY = 0;
+	int nMaxY = -1;
+
+	void Reset(int width, int height)
+	{
+		vecMinX.assign(height, width);
+		vecMaxX.assign(height, -1);
+		nMinY = height;
+		nMaxY = -1;
+	}
+
+	// Columns x1..x2 of row y have been written
+	void Mark(int x1, int x2, int y)
+	{
+		if (x1 < vecMinX[y]) vecMinX[y] = x1;
+		if (x2 > vecMaxX[y]) vecMaxX[y] = x2;
+		if (y < nMinY) nMinY = y;
+		if (y > nMaxY) nMaxY = y;
+	}
+
+	bool IsEmpty() const { return nMaxY < nMinY; }
+};
+
+// The screen buffer stores glyphs as one byte indices into this table. The
+// pixel types always have an entry, anything else (text) gets one the first
+// time it's drawn. Entries are never removed, once all 256 are taken new
+// glyphs are drawn as blanks
+class GlyphTable
+{
+	wchar_t m_glyphs[256] = { 0 };
+	int m_nGlyphs = GLYPH_COUNT;
+	unsigned char m_asciiIndex[128] = { 0 };	// index of each ASCII glyph, 0 until it has one
+
+public:
+	enum : unsigned char
+	{
+		GLYPH_EMPTY,		// zero initialized cells, shown as a blank
+		GLYPH_SOLID,
+		GLYPH_THREEQUARTERS,
+		GLYPH_HALF,
+		GLYPH_QUARTER,
+		GLYPH_COUNT,
+	};
+
+	GlyphTable()
+	{
+		m_glyphs[GLYPH_SOLID] = PIXEL_SOLID;
+		m_glyphs[GLYPH_THREEQUARTERS] = PIXEL_THREEQUARTERS;
+		m_glyphs[GLYPH_HALF] = PIXEL_HALF;
+		m_glyphs[GLYPH_QUARTER] = PIXEL_QUARTER;
+	}
+
+	wchar_t Glyph(unsigned char nIndex) const { return m_glyphs[nIndex]; }
+
+	unsigned char Index(wchar_t c)
+	{
+		switch (c)
 		{
-			while (m_bIsRunning)
+		case 0: return GLYPH_EMPTY;
+		case PIXEL_SOLID: return GLYPH_SOLID;
+		case PIXEL_THREEQUARTERS: return GLYPH_THREEQUARTERS;
+		case PIXEL_HALF: return GLYPH_HALF;
+		case PIXEL_QUARTER: return GLYPH_QUARTER;
+		default: break;
+		}
+
+		bool bASCII = (unsigned int)c < 128;
+		if (bASCII && m_asciiIndex[c])
+			return m_asciiIndex[c];
+
+		for (int i = GLYPH_COUNT; i < m_nGlyphs; i++)
+			if (m_glyphs[i] == c)
+				return (unsigned char)i;
+
+		if (m_nGlyphs == 256)
+			return GLYPH_EMPTY;
+
+		unsigned char nIndex = (unsigned char)m_nGlyphs++;
+		m_glyphs[nIndex] = c;
+		if (bASCII)
+			m_asciiIndex[c] = nIndex;
+		return nIndex;
+	}
+};
+
+// First cell in x..x1 which differs between two frames, or x1 + 1 if there's
+// none. Both planes are compared 8 cells at a time while they match
+inline int FindChangedCell(const unsigned char* glyphs, const unsigned char* attributes,
+	const unsigned char* prevGlyphs, const unsigned char* prevAttributes, int x, int x1)
+{
+	for (; x + 8 <= x1 + 1; x += 8)
+	{
+		unsigned long long g, a, pg, pa;
+		memcpy(&g, glyphs + x, 8);
+		memcpy(&a, attributes + x, 8);
+		memcpy(&pg, prevGlyphs + x, 8);
+		memcpy(&pa, prevAttributes + x, 8);
+		if ((g ^ pg) | (a ^ pa))
+			break;
+	}
+
+	while (x <= x1 && glyphs[x] == prevGlyphs[x] && attributes[x] == prevAttributes[x])
+		x++;
+	return x;
+}
+
+// Turns frames into VT escape sequences, sending only the cells which differ
+// from the last frame it encoded. Used by the terminal backend and by the
+// recording player's asciicast export
+class VTEncoder
+{
+	int m_nWidth = 0;
+	int m_nHeight = 0;
+	std::vector<unsigned char> m_vecPrevGlyphs;		// last encoded frame
+	std::vector<unsigned char> m_vecPrevAttributes;
+	bool m_bForceRedraw = true;
+	bool m_bRepeat = false;			// terminal understands REP (CSI n b)
+	int m_nByteBudget = 0;			// 0 for unlimited
+	sDirtyRegion m_dirtyCarry;		// cells held back by the byte budget, sent with the next frame
+	sDirtyRegion m_dirtyCarryNext;
+
+	static void AppendUTF8(std::string& out, wchar_t c)
+	{
+		unsigned int cp = (unsigned int)c;
+		if (cp < 0x80)
+			out += (char)cp;
+		else if (cp < 0x800)
+		{
+			out += (char)(0xC0 | (cp >> 6));
+			out += (char)(0x80 | (cp & 0x3F));
+		}
+		else if (cp < 0x10000)
+		{
+			out += (char)(0xE0 | (cp >> 12));
+			out += (char)(0x80 | ((cp >> 6) & 0x3F));
+			out += (char)(0x80 | (cp & 0x3F));
+		}
+		else
+		{
+			out += (char)(0xF0 | (cp >> 18));
+			out += (char)(0x80 | ((cp >> 12) & 0x3F));
+			out += (char)(0x80 | ((cp >> 6) & 0x3F));
+			out += (char)(0x80 | (cp & 0x3F));
+		}
+	}
+
+	// Console attributes store colors as IRGB nibbles with blue in the lowest bit,
+	// ANSI colors have red in the lowest bit
+	static int AttributeToANSI(int nibble)
+	{
+		return ((nibble & 0x1) << 2) | (nibble & 0x2) | ((nibble & 0x4) >> 2);
+	}
+
+	static int UTF8Length(wchar_t c)
+	{
+		unsigned int cp = (unsigned int)c;
+		return cp < 0x80 ? 1 : cp < 0x800 ? 2 : cp < 0x10000 ? 3 : 4;
+	}
+
+	static wchar_t CellGlyph(const GlyphTable& table, unsigned char nGlyph)
+	{
+		return nGlyph != GlyphTable::GLYPH_EMPTY ? table.Glyph(nGlyph) : L' ';
+	}
+
+	// Sets the foreground and/or background color, only sending what changed
+	static void AppendSGR(std::string& out, int& nAttributes, int nNewAttributes)
+	{
+		char seq[32];
+		int fg = nNewAttributes & 0x0F;
+		int bg = (nNewAttributes >> 4) & 0x0F;
+		int nFgCode = ((fg & 0x8) ? 90 : 30) + AttributeToANSI(fg);
+		int nBgCode = ((bg & 0x8) ? 100 : 40) + AttributeToANSI(bg);
+
+		bool bFg = nAttributes < 0 || (nAttributes & 0x0F) != fg;
+		bool bBg = nAttributes < 0 || ((nAttributes >> 4) & 0x0F) != bg;
+		if (bFg && bBg)
+			out.append(seq, snprintf(seq, sizeof(seq), "\x1b[%d;%dm", nFgCode, nBgCode));
+		else if (bFg)
+			out.append(seq, snprintf(seq, sizeof(seq), "\x1b[%dm", nFgCode));
+		else if (bBg)
+			out.append(seq, snprintf(seq, sizeof(seq), "\x1b[%dm", nBgCode));
+
+		nAttributes = nNewAttributes & 0xFF;
+	}
+
+public:
+	// Forgets the last frame, so the next one is sent whole
+	void Reset(int nWidth, int nHeight)
+	{
+		m_nWidth = nWidth;
+		m_nHeight = nHeight;
+		m_vecPrevGlyphs.assign(nWidth * nHeight, GlyphTable::GLYPH_EMPTY);
+		m_vecPrevAttributes.assign(nWidth * nHeight, 0);
+		m_dirtyCarry.Reset(nWidth, nHeight);
+		m_bForceRedraw = true;
+	}
+
+	void SetRepeat(bool bRepeat) { m_bRepeat = bRepeat; }
+	void SetByteBudget(int nByteBudget) { m_nByteBudget = (std::max)(0, nByteBudget); }
+
+	// Appends the sequences turning the last encoded frame into the one given by
+	// its glyph and attribute planes to out. Cells outside the dirty region (plus
+	// whatever the byte budget held back last time) can't have changed and aren't
+	// compared. Runs of identical cells are sent as one glyph followed by REP,
+	// colors only when they change, and short gaps on a row are skipped with a
+	// cursor forward or by rewriting them
+	void Encode(const unsigned char* bufGlyphs, const unsigned char* bufAttributes, const GlyphTable& table, const sDirtyRegion& dirty, std::string& out)
+	{
+		char seq[32];
+		int nCursorX = -1, nCursorY = -1;
+		int nAttributes = -1;
+		bool bOverBudget = false;
+		size_t nFrameStart = out.size();
+		sDirtyRegion& carry = m_dirtyCarry;
+		sDirtyRegion& carryNext = m_dirtyCarryNext;
+		carryNext.Reset(m_nWidth, m_nHeight);
+
+		int nMinY = m_bForceRedraw ? 0 : (std::min)(dirty.nMinY, carry.nMinY);
+		int nMaxY = m_bForceRedraw ? m_nHeight - 1 : (std::max)(dirty.nMaxY, carry.nMaxY);
+
+		for (int y = nMinY; y <= nMaxY; y++)
+		{
+			const unsigned char* glyphs = bufGlyphs + y * m_nWidth;
+			const unsigned char* attributes = bufAttributes + y * m_nWidth;
+			unsigned char* prevGlyphs = m_vecPrevGlyphs.data() + y * m_nWidth;
+			unsigned char* prevAttributes = m_vecPrevAttributes.data() + y * m_nWidth;
+			auto SameCell = [&](int i, int j) { return glyphs[i] == glyphs[j] && attributes[i] == attributes[j]; };
+
+			int x0 = m_bForceRedraw ? 0 : (std::min)(dirty.vecMinX[y], carry.vecMinX[y]);
+			int x1 = m_bForceRedraw ? m_nWidth - 1 : (std::max)(dirty.vecMaxX[y], carry.vecMaxX[y]);
+
+			int x = x0;
+			while (x <= x1)
 			{
-				dt2 = std::chrono::system_clock::now();
-				std::chrono::duration<float> elapsedTime = dt2 - dt1;
-				dt1 = dt2;
-				float fElapsedTime = elapsedTime.count();
+				if (!m_bForceRedraw)
+				{
+					x = FindChangedCell(glyphs, attributes, prevGlyphs, prevAttributes, x, x1);
+					if (x > x1)
+						break;
+				}
+
+				if (bOverBudget)
+				{
+					for (int yCarry = y; yCarry <= nMaxY; yCarry++)
+					{
+						int xFrom = yCarry == y ? x : 0;
+						carryNext.vecMinX[yCarry] = xFrom;
+						carryNext.vecMaxX[yCarry] = m_nWidth - 1;
+					}
+					carryNext.nMinY = y;
+					carryNext.nMaxY = nMaxY;
+					y = nMaxY;
+					break;
+				}
+
+				// Extend the run over identical cells, up to the last one which changed
+				int nLastChanged = x;
+				for (int i = x + 1; i <= x1 && SameCell(i, x); i++)
+				{
+					if (m_bForceRedraw || glyphs[i] != prevGlyphs[i] || attributes[i] != prevAttributes[i])
+						nLastChanged = i;
+				}
+				int nRun = nLastChanged - x + 1;
+
+				size_t nRunStart = out.size();
+
+				// Move the cursor
+				int nGap = x - nCursorX;
+				if (y == nCursorY && nGap > 0)
+				{
+					// Rewriting a couple of unchanged cells is cheaper than moving over them
+					bool bRewrite = nGap <= 2;
+					for (int i = nCursorX; bRewrite && i < x; i++)
+						bRewrite = attributes[i] == nAttributes;
+
+					if (bRewrite)
+					{
+						for (int i = nCursorX; i < x; i++)
+							AppendUTF8(out, CellGlyph(table, glyphs[i]));
+					}
+					else if (nGap == 1)
+						out += "\x1b[C";
+					else
+						out.append(seq, snprintf(seq, sizeof(seq), "\x1b[%dC", nGap));
+				}
+				else if (x != nCursorX || y != nCursorY)
+					out.append(seq, snprintf(seq, sizeof(seq), "\x1b[%d;%dH", y + 1, x + 1));
+
+				if (attributes[x] != nAttributes)
+					AppendSGR(out, nAttributes, attributes[x]);
+
+				// Glyph, then either REP or the glyph again, whichever is shorter
+				wchar_t glyph = CellGlyph(table, glyphs[x]);
+				AppendUTF8(out, glyph);
+				if (nRun > 1)
+				{
+					int nRepLength = snprintf(seq, sizeof(seq), "\x1b[%db", nRun - 1);
+					if (m_bRepeat && nRepLength < (nRun - 1) * UTF8Length(glyph))
+						out.append(seq, nRepLength);
+					else
+						for (int i = 1; i < nRun; i++)
+							AppendUTF8(out, glyph);
+				}
+
+				// Out of budget - drop this run and hold the rest of the frame back
+				if (m_nByteBudget > 0 && nRunStart > nFrameStart && out.size() - nFrameStart > (size_t)m_nByteBudget)
+				{
+					out.resize(nRunStart);
+					bOverBudget = true;
+					continue;
+				}
+
+				memcpy(prevGlyphs + x, glyphs + x, nRun);
+				memcpy(prevAttributes + x, attributes + x, nRun);
+
+				x += nRun;
+				nCursorX = x;
+				nCursorY = y;
+			}
+		}
+
+		std::swap(carry, carryNext);
+		m_bForceRedraw = false;
+	}
+};
+
+// Recordings (.cgr) are a header followed by one record per frame, with every
+// number stored as an unsigned LEB128 varint
+//   header - "CGRF", version, width, height
+//   frame  - time since the previous frame in microseconds, payload size, payload
+// The payload lists the cells which changed since the previous frame as
+// (cells skipped since the last change, count << 1 | run) followed by count
+// cells, or for a run by one cell repeated count times. Positions carry on
+// from one row to the next, a cell is its character then its attributes, and
+// the frame before the first one is all zeros
+namespace FrameRecording
+{
+	constexpr unsigned int VERSION = 1;
+	constexpr int MAX_SIZE = 4096;			// largest width/height accepted when reading
+
+	inline void AppendVarint(std::vector<unsigned char>& out, unsigned long long n)
+	{
+		while (n >= 0x80)
+		{
+			out.push_back((unsigned char)(n | 0x80));
+			n >>= 7;
+		}
+		out.push_back((unsigned char)n);
+	}
+
+	inline bool ReadVarint(const unsigned char*& p, const unsigned char* end, unsigned long long& n)
+	{
+		n = 0;
+		for (int shift = 0; p < end && shift < 64; shift += 7)
+		{
+			unsigned char b = *p++;
+			n |= (unsigned long long)(b & 0x7F) << shift;
+			if (!(b & 0x80))
+				return true;
+		}
+		return false;
+	}
+}
+
+// Records frames to a .cgr file. The game thread encodes each frame against
+// the previous one, comparing only the dirty region, and a writer thread
+// streams the encoded frames to disk a few times per second
+class FrameRecorder
+{
+	int m_nWidth = 0;
+	int m_nHeight = 0;
+	std::vector<unsigned char> m_vecPrevGlyphs;		// last recorded frame
+	std::vector<unsigned char> m_vecPrevAttributes;
+	bool m_bFull = true;					// compare the whole frame, not just the dirty region
+	std::vector<unsigned char> m_vecPayload;
+	std::vector<unsigned char> m_vecPending;	// encoded frames waiting for the writer
+	std::mutex m_muxPending;
+	std::ofstream m_file;
+	std::thread m_writerThread;
+	std::atomic<bool> m_bQuit{ false };
+	long long m_nFrames = 0;
+
+	// Cells are recorded as characters rather than glyph indices, so recordings
+	// don't depend on the order glyphs were added to the table
+	void AppendCell(const GlyphTable& table, unsigned char nGlyph, unsigned char nAttributes)
+	{
+		FrameRecording::AppendVarint(m_vecPayload, (unsigned int)table.Glyph(nGlyph));
+		FrameRecording::AppendVarint(m_vecPayload, nAttributes);
+	}
+
+	void WriterThread()
+	{
+		std::vector<unsigned char> vecWrite;
+		auto WritePending = [&]() {
+			{
+				std::unique_lock<std::mutex> ul(m_muxPending);
+				std::swap(vecWrite, m_vecPending);
+			}
+			if (vecWrite.empty())
+				return;
+
+			m_file.write((const char*)vecWrite.data(), vecWrite.size());
+			m_file.flush();
+			vecWrite.clear();
+		};
+
+		while (!m_bQuit)
+		{
+			WritePending();
+			std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		}
+
+		WritePending();
+	}
+
+public:
+	~FrameRecorder() { Stop(); }
+
+	bool Start(const std::string& sFile, int nWidth, int nHeight)
+	{
+		if (IsRecording())
+			return false;
+
+		m_file.open(sFile, std::ios::out | std::ios::binary | std::ios::trunc);
+		if (!m_file)
+			return false;
+
+		m_nWidth = nWidth;
+		m_nHeight = nHeight;
+		m_vecPrevGlyphs.assign(nWidth * nHeight, GlyphTable::GLYPH_EMPTY);
+		m_vecPrevAttributes.assign(nWidth * nHeight, 0);
+		m_bFull = true;
+		m_nFrames = 0;
+
+		std::vector<unsigned char> header = { 'C', 'G', 'R', 'F' };
+		FrameRecording::AppendVarint(header, FrameRecording::VERSION);
+		FrameRecording::AppendVarint(header, nWidth);
+		FrameRecording::AppendVarint(header, nHeight);
+		m_file.write((const char*)header.data(), header.size());
+
+		m_bQuit = false;
+		m_writerThread = std::thread(&FrameRecorder::WriterThread, this);
+		return true;
+	}
+
+	// Writes out whatever is still queued and closes the file
+	void Stop()
+	{
+		if (!m_writerThread.joinable())
+			return;
+
+		m_bQuit = true;
+		m_writerThread.join();
+		m_file.close();
+	}
+
+	bool IsRecording() const { return m_writerThread.joinable(); }
+	long long GetFramesRecorded() const { return m_nFrames; }
+
+	// Encodes the cells which changed since the last recorded frame and queues
+	// them for the writer. Cells outside the dirty region aren't looked at
+	void RecordFrame(const unsigned char* bufGlyphs, const unsigned char* bufAttributes, const GlyphTable& table, const sDirtyRegion& dirty, float fElapsedTime)
+	{
+		m_vecPayload.clear();
+		int nPos = 0;
+
+		int nMinY = m_bFull ? 0 : dirty.nMinY;
+		int nMaxY = m_bFull ? m_nHeight - 1 : dirty.nMaxY;
+
+		for (int y = nMinY; y <= nMaxY; y++)
+		{
+			const unsigned char* glyphs = bufGlyphs + y * m_nWidth;
+			const unsigned char* attributes = bufAttributes + y * m_nWidth;
+			unsigned char* prevGlyphs = m_vecPrevGlyphs.data() + y * m_nWidth;
+			unsigned char* prevAttributes = m_vecPrevAttributes.data() + y * m_nWidth;
+			auto SameCell = [&](int i, int j) { return glyphs[i] == glyphs[j] && attributes[i] == attributes[j]; };
+			auto Changed = [&](int i) { return m_bFull || glyphs[i] != prevGlyphs[i] || attributes[i] != prevAttributes[i]; };
+
+			int x0 = m_bFull ? 0 : dirty.vecMinX[y];
+			int x1 = m_bFull ? m_nWidth - 1 : dirty.vecMaxX[y];
+
+			int x = x0;
+			while (x <= x1)
+			{
+				if (!m_bFull)
+				{
+					x = FindChangedCell(glyphs, attributes, prevGlyphs, prevAttributes, x, x1);
+					if (x > x1)
+						break;
+				}
+
+				// Identical cells, up to the last one which changed
+				int nCount = 1;
+				for (int i = x + 1; i <= x1 && SameCell(i, x); i++)
+				{
+					if (Changed(i))
+						nCount = i - x + 1;
+				}
+
+				// Too short for a run, take changed cells up to the next run instead
+				bool bRun = nCount >= 3;
+				if (!bRun)
+				{
+					nCount = 1;
+					for (int i = x + 1; i <= x1 && Changed(i); i++, nCount++)
+					{
+						if (i + 2 <= x1 && SameCell(i, i + 1) && SameCell(i, i + 2))
+							break;
+					}
+				}
+
+				FrameRecording::AppendVarint(m_vecPayload, y * m_nWidth + x - nPos);
+				FrameRecording::AppendVarint(m_vecPayload, ((unsigned long long)nCount << 1) | (bRun ? 1 : 0));
+				for (int i = x; i < x + (bRun ? 1 : nCount); i++)
+					AppendCell(table, glyphs[i], attributes[i]);
+
+				memcpy(prevGlyphs + x, glyphs + x, nCount);
+				memcpy(prevAttributes + x, attributes + x, nCount);
+
+				x += nCount;
+				nPos = y * m_nWidth + x;
+			}
+		}
+
+		m_bFull = false;
+		m_nFrames++;
+
+		unsigned long long nTime = (unsigned long long)((std::max)(fElapsedTime, 0.0f) * 1000000.0f + 0.5f);
+		std::unique_lock<std::mutex> ul(m_muxPending);
+		FrameRecording::AppendVarint(m_vecPending, nTime);
+		FrameRecording::AppendVarint(m_vecPending, m_vecPayload.size());
+		m_vecPending.insert(m_vecPending.end(), m_vecPayload.begin(), m_vecPayload.end());
+	}
+};
+
+// Layout of the shared memory frame export. The header is followed by two frame
+// slots which the engine fills alternately, so a reader has a whole frame to
+// look at the latest one in place before it gets written over. Every slot has
+// its own seqlock counter, odd while the slot is being written
+struct sSharedFrameSlot
+{
+	std::atomic<unsigned long long> nSequence;
+	long long nFrame;
+	float fElapsedTime;
+};
+
+struct sSharedFrameHeader
+{
+	char magic[4];						// "CGSF"
+	unsigned int nVersion;
+	int nWidth;
+	int nHeight;
+	unsigned int nCellSize;				// sizeof(CHAR_INFO), 4 on Windows and 8 elsewhere
+	std::atomic<unsigned int> nFront;	// slot holding the latest finished frame
+	std::atomic<long long> nFrames;		// frames published so far
+	sSharedFrameSlot slots[2];
+};
+
+// Named shared memory holding the latest frames (shm_open name on POSIX, file
+// mapping name on Windows). The engine creates and publishes, viewers open it
+// and read with GetLatestFrame/IsFrameIntact:
+//   const CHAR_INFO* buf = shared.GetLatestFrame(nSlot, nSequence);
+//   ... read buf ...
+//   if (!shared.IsFrameIntact(nSlot, nSequence)) ... it was overwritten, try again
+class SharedFrameBuffer
+{
+	static constexpr unsigned int VERSION = 1;
+
+	sSharedFrameHeader* m_header = nullptr;
+	size_t m_nSize = 0;
+	bool m_bOwner = false;
+	std::string m_sName;
+#ifdef _WIN32
+	HANDLE m_hMapping = NULL;
+#endif
+
+	static size_t FrameOffset(int nSlot, int nWidth, int nHeight)
+	{
+		size_t nHeaderSize = (sizeof(sSharedFrameHeader) + 63) & ~(size_t)63;
+		return nHeaderSize + (size_t)nSlot * nWidth * nHeight * sizeof(CHAR_INFO);
+	}
+
+	CHAR_INFO* Frame(int nSlot) const
+	{
+		return (CHAR_INFO*)((char*)m_header + FrameOffset(nSlot, m_header->nWidth, m_header->nHeight));
+	}
+
+	// Maps nSize bytes of a new segment, or all of an existing one when nSize is 0.
+	// A new segment must not exist yet, so a second game sharing under the same
+	// name fails instead of resizing and clearing the first one's frames
+	bool Map(const std::string& sName, size_t nSize)
+	{
+#ifdef _WIN32
+		if (nSize)
+			m_hMapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, (DWORD)((unsigned long long)nSize >> 32), (DWORD)nSize, sName.c_str());
+		else
+			m_hMapping = OpenFileMappingA(FILE_MAP_READ, FALSE, sName.c_str());
+		if (!m_hMapping)
+			return false;
+
+		if (nSize && GetLastError() == ERROR_ALREADY_EXISTS)
+		{
+			CloseHandle(m_hMapping);
+			m_hMapping = NULL;
+			SetLastError(ERROR_ALREADY_EXISTS);
+			return false;
+		}
+
+		m_header = (sSharedFrameHeader*)MapViewOfFile(m_hMapping, nSize ? FILE_MAP_ALL_ACCESS : FILE_MAP_READ, 0, 0, 0);
+		if (!m_header)
+			return false;
+
+		MEMORY_BASIC_INFORMATION info;
+		VirtualQuery(m_header, &info, sizeof(info));
+		m_nSize = info.RegionSize;
+#else
+		// POSIX names start with a slash
+		std::string sPath = sName[0] == '/' ? sName : "/" + sName;
+		int fd = nSize ? shm_open(sPath.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644) : shm_open(sPath.c_str(), O_RDONLY, 0);
+		if (fd == -1)
+			return false;
+
+		// Ours from here on, so Close unlinks it even if the rest fails
+		m_bOwner = nSize != 0;
+		m_sName = sPath;
+
+		struct stat st;
+		if ((nSize && ftruncate(fd, nSize) == -1) || (!nSize && fstat(fd, &st) == -1))
+		{
+			close(fd);
+			return false;
+		}
+
+		m_nSize = nSize ? nSize : (size_t)st.st_size;
+		void* p = mmap(nullptr, m_nSize, nSize ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+		close(fd);
+		if (p == MAP_FAILED)
+			return false;
+
+		m_header = (sSharedFrameHeader*)p;
+#endif
+		return true;
+	}
+
+public:
+	~SharedFrameBuffer() { Close(); }
+
+	// Engine side - creates the segment for frames of nWidth x nHeight
+	bool Create(const std::string& sName, int nWidth, int nHeight)
+	{
+		if (IsOpen() || sName.empty())
+			return false;
+
+		if (!Map(sName, FrameOffset(2, nWidth, nHeight)))
+		{
+			Close();
+			return false;
+		}
+
+		memset((void*)m_header, 0, FrameOffset(2, nWidth, nHeight));
+		memcpy(m_header->magic, "CGSF", 4);
+		m_header->nVersion = VERSION;
+		m_header->nWidth = nWidth;
+		m_header->nHeight = nHeight;
+		m_header->nCellSize = sizeof(CHAR_INFO);
+		return true;
+	}
+
+	// Viewer side - opens a segment created by a running game, read only
+	bool Open(const std::string& sName)
+	{
+		if (IsOpen() || sName.empty())
+			return false;
+
+		if (!Map(sName, 0) || m_nSize < sizeof(sSharedFrameHeader) || memcmp(m_header->magic, "CGSF", 4) != 0 ||
+			m_header->nVersion != VERSION || m_header->nCellSize != sizeof(CHAR_INFO) ||
+			m_nSize < FrameOffset(2, m_header->nWidth, m_header->nHeight))
+		{
+			Close();
+			return false;
+		}
+
+		return true;
+	}
+
+	void Close()
+	{
+#ifdef _WIN32
+		if (m_header)
+			UnmapViewOfFile(m_header);
+		if (m_hMapping)
+			CloseHandle(m_hMapping);
+		m_hMapping = NULL;
+#else
+		if (m_header)
+			munmap(m_header, m_nSize);
+		if (m_bOwner && !m_sName.empty())
+			shm_unlink(m_sName.c_str());
+		m_sName.clear();
+#endif
+		m_header = nullptr;
+		m_nSize = 0;
+		m_bOwner = false;
+	}
+
+	bool IsOpen() const { return m_header != nullptr; }
+	int GetWidth() const { return m_header ? m_header->nWidth : 0; }
+	int GetHeight() const { return m_header ? m_header->nHeight : 0; }
+	long long GetFramesPublished() const { return m_header ? m_header->nFrames.load(std::memory_order_acquire) : 0; }
+
+	// Converts a finished frame into the slot readers aren't looking at, then
+	// makes it the front one
+	void Publish(const unsigned char* bufGlyphs, const unsigned char* bufAttributes, const GlyphTable& table, float fElapsedTime)
+	{
+		unsigned int nBack = 1 - m_header->nFront.load(std::memory_order_relaxed);
+		sSharedFrameSlot& slot = m_header->slots[nBack];
+		unsigned long long nSequence = slot.nSequence.load(std::memory_order_relaxed);
+		long long nFrame = m_header->nFrames.load(std::memory_order_relaxed);
+
+		slot.nSequence.store(nSequence + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+
+		CHAR_INFO* bufFrame = Frame(nBack);
+		for (int i = 0; i < m_header->nWidth * m_header->nHeight; i++)
+		{
+			bufFrame[i].Char.UnicodeChar = table.Glyph(bufGlyphs[i]);
+			bufFrame[i].Attributes = bufAttributes[i];
+		}
+		slot.nFrame = nFrame;
+		slot.fElapsedTime = fElapsedTime;
+
+		slot.nSequence.store(nSequence + 2, std::memory_order_release);
+		m_header->nFront.store(nBack, std::memory_order_release);
+		m_header->nFrames.store(nFrame + 1, std::memory_order_release);
+	}
+
+	// The latest finished frame, in place. nullptr if nothing has been published
+	// yet. pFrame and pElapsedTime are only trustworthy once IsFrameIntact agrees
+	const CHAR_INFO* GetLatestFrame(int& nSlot, unsigned long long& nSequence, long long* pFrame = nullptr, float* pElapsedTime = nullptr) const
+	{
+		if (GetFramesPublished() == 0)
+			return nullptr;
+
+		nSlot = (int)m_header->nFront.load(std::memory_order_acquire);
+		const sSharedFrameSlot& slot = m_header->slots[nSlot];
+		nSequence = slot.nSequence.load(std::memory_order_acquire);
+		if (nSequence & 1)
+			return nullptr;		// overtaken by the engine twice over, it's writing this slot again
+
+		if (pFrame)
+			*pFrame = slot.nFrame;
+		if (pElapsedTime)
+			*pElapsedTime = slot.fElapsedTime;
+		return Frame(nSlot);
+	}
+
+	// Whether a frame from GetLatestFrame was left alone while it was being read
+	bool IsFrameIntact(int nSlot, unsigned long long nSequence) const
+	{
+		std::atomic_thread_fence(std::memory_order_acquire);
+		return m_header->slots[nSlot].nSequence.load(std::memory_order_relaxed) == nSequence;
+	}
+};
+
+// Plays back a .cgr recording one frame at a time
+class FrameRecordingReader
+{
+	std::ifstream m_file;
+	int m_nWidth = 0;
+	int m_nHeight = 0;
+	std::vector<CHAR_INFO> m_vecFrame;
+	std::vector<unsigned char> m_vecPayload;
+	sDirtyRegion m_dirty;
+
+	bool ReadVarint(unsigned long long& n)
+	{
+		n = 0;
+		for (int shift = 0; shift < 64; shift += 7)
+		{
+			int b = m_file.get();
+			if (b == EOF)
+				return false;
+			n |= (unsigned long long)(b & 0x7F) << shift;
+			if (!(b & 0x80))
+				return true;
+		}
+		return false;
+	}
+
+	static bool ReadCell(const unsigned char*& p, const unsigned char* end, CHAR_INFO& cell)
+	{
+		unsigned long long nChar, nAttributes;
+		if (!FrameRecording::ReadVarint(p, end, nChar) || !FrameRecording::ReadVarint(p, end, nAttributes))
+			return false;
+
+		cell.Char.UnicodeChar = (wchar_t)nChar;
+		cell.Attributes = (unsigned short)nAttributes;
+		return true;
+	}
+
+public:
+	bool Open(const std::string& sFile)
+	{
+		m_file.open(sFile, std::ios::in | std::ios::binary);
+
+		char magic[4];
+		if (!m_file.read(magic, 4) || memcmp(magic, "CGRF", 4) != 0)
+			return false;
+
+		unsigned long long nVersion, nWidth, nHeight;
+		if (!ReadVarint(nVersion) || nVersion != FrameRecording::VERSION)
+			return false;
+		if (!ReadVarint(nWidth) || !ReadVarint(nHeight))
+			return false;
+		if (nWidth == 0 || nHeight == 0 || nWidth > FrameRecording::MAX_SIZE || nHeight > FrameRecording::MAX_SIZE)
+			return false;
+
+		m_nWidth = (int)nWidth;
+		m_nHeight = (int)nHeight;
+		m_vecFrame.assign(m_nWidth * m_nHeight, CHAR_INFO{});
+		m_dirty.Reset(m_nWidth, m_nHeight);
+		return true;
+	}
+
+	int GetWidth() const { return m_nWidth; }
+	int GetHeight() const { return m_nHeight; }
+	const CHAR_INFO* GetFrame() const { return m_vecFrame.data(); }
+
+	// Cells changed by the last ReadFrame
+	const sDirtyRegion& GetDirty() const { return m_dirty; }
+
+	// Applies the next frame on top of the current one, fElapsedTime gets the time
+	// since the previous frame. Returns false at the end of the recording, or at
+	// a frame which is cut off or damaged
+	bool ReadFrame(float& fElapsedTime)
+	{
+		unsigned long long nTime, nSize;
+		if (!ReadVarint(nTime) || !ReadVarint(nSize))
+			return false;
+
+		// Even a cell with a segment to itself stays well under 16 bytes
+		if (nSize > 16ULL * m_nWidth * m_nHeight)
+			return false;
+
+		m_vecPayload.resize((size_t)nSize);
+		if (nSize > 0 && !m_file.read((char*)m_vecPayload.data(), nSize))
+			return false;
+
+		m_dirty.Reset(m_nWidth, m_nHeight);
+
+		const unsigned char* p = m_vecPayload.data();
+		const unsigned char* end = p + m_vecPayload.size();
+		unsigned long long nCells = (unsigned long long)m_nWidth * m_nHeight;
+		unsigned long long nPos = 0;
+		while (p < end)
+		{
+			unsigned long long nSkip, nHeader;
+			if (!FrameRecording::ReadVarint(p, end, nSkip) || !FrameRecording::ReadVarint(p, end, nHeader))
+				return false;
+
+			unsigned long long nCount = nHeader >> 1;
+			if (nCount == 0 || nSkip > nCells - nPos || nCount > nCells - nPos - nSkip)
+				return false;
+			nPos += nSkip;
+
+			CHAR_INFO cell;
+			for (unsigned long long i = 0; i < nCount; i++)
+			{
+				if ((i == 0 || !(nHeader & 1)) && !ReadCell(p, end, cell))
+					return false;
+				m_vecFrame[nPos + i] = cell;
+			}
+
+			// Mark the cells, which can run over several rows
+			for (unsigned long long nCell = nPos; nCell < nPos + nCount;)
+			{
+				int y = (int)(nCell / m_nWidth);
+				int x1 = (int)(nCell % m_nWidth);
+				int x2 = (int)(std::min)((unsigned long long)m_nWidth - 1, x1 + (nPos + nCount - 1 - nCell));
+				m_dirty.Mark(x1, x2, y);
+				nCell += x2 - x1 + 1;
+			}
+
+			nPos += nCount;
+		}
+
+		fElapsedTime = nTime / 1000000.0f;
+		return true;
+	}
+};
+
+// Runs the jobs of a batch on a fixed set of worker threads and the calling
+// thread. Run returns once every job of the batch has finished
+class WorkerPool
+{
+	std::vector<std::thread> m_threads;
+	std::mutex m_mux;
+	std::condition_variable m_cvBatch;
+	std::condition_variable m_cvDone;
+	const std::function<void(int)>* m_job = nullptr;
+	int m_nJobs = 0;					// 0 between batches
+	std::atomic<int> m_nNextJob{ 0 };
+	int m_nJobsDone = 0;
+	int m_nActive = 0;					// workers taking jobs from the current batch
+	unsigned long long m_nBatch = 0;
+	bool m_bQuit = false;
+
+	// Takes jobs until there are none left, returns how many it ran
+	int RunJobs(const std::function<void(int)>* job, int nJobs)
+	{
+		int nDone = 0;
+		if (nJobs == 0)
+			return 0;
+
+		for (int i = m_nNextJob.fetch_add(1); i < nJobs; i = m_nNextJob.fetch_add(1))
+		{
+			(*job)(i);
+			nDone++;
+		}
+		return nDone;
+	}
+
+	void WorkerThread()
+	{
+		unsigned long long nBatch = 0;
+		std::unique_lock<std::mutex> ul(m_mux);
+		while (true)
+		{
+			m_cvBatch.wait(ul, [&] { return m_bQuit || m_nBatch != nBatch; });
+			if (m_bQuit)
+				return;
+
+			// A worker waking up after its batch finished sees no jobs
+			nBatch = m_nBatch;
+			const std::function<void(int)>* job = m_job;
+			int nJobs = m_nJobs;
+			m_nActive++;
+
+			ul.unlock();
+			int nDone = RunJobs(job, nJobs);
+			ul.lock();
+
+			m_nActive--;
+			m_nJobsDone += nDone;
+			if (m_nActive == 0 && m_nJobsDone == m_nJobs)
+				m_cvDone.notify_one();
+		}
+	}
+
+public:
+	~WorkerPool() { Stop(); }
+
+	void Start(int nThreads)
+	{
+		Stop();
+		m_bQuit = false;
+		for (int i = 0; i < nThreads; i++)
+			m_threads.emplace_back(&WorkerPool::WorkerThread, this);
+	}
+
+	void Stop()
+	{
+		{
+			std::lock_guard<std::mutex> lg(m_mux);
+			m_bQuit = true;
+		}
+		m_cvBatch.notify_all();
+
+		for (std::thread& t : m_threads)
+			t.join();
+		m_threads.clear();
+	}
+
+	// Worker threads plus the one calling Run
+	int GetThreadCount() const { return (int)m_threads.size() + 1; }
+
+	// Calls job(0) .. job(nJobs - 1), spread over the threads in no particular order
+	void Run(int nJobs, const std::function<void(int)>& job)
+	{
+		if (m_threads.empty())
+		{
+			for (int i = 0; i < nJobs; i++)
+				job(i);
+			return;
+		}
+
+		{
+			std::lock_guard<std::mutex> lg(m_mux);
+			m_job = &job;
+			m_nJobs = nJobs;
+			m_nNextJob = 0;
+			m_nJobsDone = 0;
+			m_nBatch++;
+		}
+		m_cvBatch.notify_all();
+
+		int nDone = RunJobs(&job, nJobs);
+
+		std::unique_lock<std::mutex> ul(m_mux);
+		m_nJobsDone += nDone;
+		m_cvDone.wait(ul, [&] { return m_nActive == 0 && m_nJobsDone == m_nJobs; });
+		m_job = nullptr;
+		m_nJobs = 0;
+	}
+};
+
+enum DRAW_COMMAND
+{
+	DRAW_FILL,
+	DRAW_FILL_TRIANGLE,
+	DRAW_TRIANGLE_EDGES,
+	DRAW_SPANS,
+	DRAW_LINE,
+};
+
+// One run of cells in a row of a shape, relative to its anchor cell
+struct sShapeSpan
+{
+	int dy, x1, x2;
+	bool bEdge;		// drawn in the edge color
+};
+
+enum RASTER_SHAPE
+{
+	RASTER_ELLIPSE,			// radii and whether it's filled, anchored at the center
+	RASTER_TRIANGLE,		// the other corners from the first, which is the anchor
+};
+
+struct sRasterKey
+{
+	RASTER_SHAPE shape;
+	int v[5];
+
+	bool operator==(const sRasterKey& k) const { return shape == k.shape && memcmp(v, k.v, sizeof(v)) == 0; }
+};
+
+struct sRasterKeyHash
+{
+	size_t operator()(const sRasterKey& k) const
+	{
+		size_t hash = 2166136261u;
+		hash = (hash ^ (size_t)k.shape) * 16777619u;
+		for (int n : k.v)
+			hash = (hash ^ (size_t)(unsigned int)n) * 16777619u;
+		return hash;
+	}
+};
+
+// Rasterized primitives as span tables, the least recently used going first once
+// there are more than the capacity. Commands binned for tiled rendering point
+// into entries, so Trim is only called while nothing is binned
+class RasterCache
+{
+	struct sUse
+	{
+		sRasterKey key;
+		long long nFrame;		// frame the entry was last drawn in
+	};
+
+	struct sEntry
+	{
+		std::vector<sShapeSpan> vecSpans;
+		std::list<sUse>::iterator itUse;
+	};
+
+	std::unordered_map<sRasterKey, sEntry, sRasterKeyHash> m_mapEntries;
+	std::list<sUse> m_listUse;	// most recently used first
+	std::vector<size_t> m_vecMissed;	// hashes of keys missed once and not cached, one per slot
+	size_t m_nCapacity = 512;
+	long long m_nFrame = 0;
+	long long m_nHits = 0;
+	long long m_nMisses = 0;
+	long long m_nEvictions = 0;
+
+public:
+	// The spans cached for key, or nullptr after counting a miss
+	const std::vector<sShapeSpan>* Find(const sRasterKey& key)
+	{
+		auto it = m_mapEntries.find(key);
+		if (it == m_mapEntries.end())
+		{
+			m_nMisses++;
+			return nullptr;
+		}
+
+		m_nHits++;
+		it->second.itUse->nFrame = m_nFrame;
+		m_listUse.splice(m_listUse.begin(), m_listUse, it->second.itUse);
+		return &it->second.vecSpans;
+	}
+
+	// Whether a new entry can go in without evicting one drawn in this frame or
+	// the last. When more shapes are drawn every frame than the cache holds, the
+	// ones already in stay and the rest are rasterized directly, instead of each
+	// evicting another in turn and none ever being found again
+	bool HasRoom() const
+	{
+		return m_listUse.size() < m_nCapacity || m_listUse.back().nFrame < m_nFrame - 1;
+	}
+
+	// Whether a missed key is worth caching, which it is the second time it's
+	// missed. Shapes drawn once and never again are rasterized directly instead
+	// of filling the cache
+	bool Admit(const sRasterKey& key)
+	{
+		if (m_vecMissed.size() != 4 * m_nCapacity)
+			m_vecMissed.assign(4 * m_nCapacity, 0);
+
+		// A newer miss takes over the slot, so a key which isn't drawn again soon is forgotten
+		size_t hash = sRasterKeyHash()(key) | 1;
+		size_t& slot = m_vecMissed[hash % m_vecMissed.size()];
+		if (slot == hash)
+		{
+			slot = 0;
+			return true;
+		}
+
+		slot = hash;
+		return false;
+	}
+
+	// An empty entry for key to rasterize into, call Find first
+	std::vector<sShapeSpan>& Insert(const sRasterKey& key)
+	{
+		m_listUse.push_front({ key, m_nFrame });
+		sEntry& entry = m_mapEntries[key];
+		entry.itUse = m_listUse.begin();
+		return entry.vecSpans;
+	}
+
+	// Evicts down to one less than the capacity, making room for an Insert
+	void Trim()
+	{
+		while (!m_listUse.empty() && m_listUse.size() >= m_nCapacity)
+		{
+			m_mapEntries.erase(m_listUse.back().key);
+			m_listUse.pop_back();
+			m_nEvictions++;
+		}
+	}
+
+	void SetCapacity(size_t nCapacity) { m_nCapacity = nCapacity; }
+	size_t Capacity() const { return m_nCapacity; }
+
+	// Call once a frame has been drawn
+	void NextFrame() { m_nFrame++; }
+
+	sRasterCacheStats Stats() const { return { m_nHits, m_nMisses, m_nEvictions, (int)m_mapEntries.size() }; }
+};
+
+// A primitive, as drawn straight away or binned into tiles
+struct sDrawCommand
+{
+	DRAW_COMMAND type;
+	int x1, y1, x2, y2;			// bounds, inclusive
+	int px[3], py[3];			// triangle corners, line ends, or the center of a shape
+	const sShapeSpan* pSpans;	// a circle or ellipse, from the span table cache
+	int nSpans;
+	unsigned char nGlyph;
+	unsigned char nAttributes;
+	unsigned char nEdgeAttributes;	// color of a triangle's outline
+	bool bOutline;					// draw the triangle's edges over its inside
+};
+
+// A rectangle of cells drawing is restricted to, inclusive
+struct sClipRect
+{
+	int x1, y1, x2, y2;
+
+	bool operator==(const sClipRect& r) const { return x1 == r.x1 && y1 == r.y1 && x2 == r.x2 && y2 == r.y2; }
+};
+
+class CrabbyGraphics
+{
+private:
+	int m_screenWidth;
+	int m_screenHeight;
+#ifdef _WIN32
+	HANDLE m_hConsole;
+	HANDLE m_hConsoleInput;
+	HANDLE m_hOriginalConsole;
+	SMALL_RECT m_rectWindow;
+	CHAR_INFO* m_bufPresentCells = nullptr;		// the frame converted to console cells for WriteConsoleOutput
+#else
+	// VT backend - keeps the last presented frame to only send the cells that changed
+	VTEncoder m_vtEncoder;
+	bool m_bVTRepeatSet = false;		// SetVTOptions chose REP, don't guess it from $TERM
+	std::string m_sFrameOut;
+	termios m_termOriginal;
+	bool m_bTermModeChanged = false;
+	bool m_bTermActive = false;
+#endif
+	bool m_bIsConsoleInFocus = true;
+	bool m_bHeadless = false;
+	bool m_bHeadlessSetup = false;
+
+	int m_mousePosX = 0;
+	int m_mousePosY = 0;
+
+	// Input thread - pushes events as they arrive, the game thread drains them
+	SPSCQueue<sInputEvent, 1024> m_queueInput;
+	std::thread m_inputThread;
+	std::atomic<bool> m_bInputQuit{ false };
+	std::atomic<long long> m_nInputDropped{ 0 };
+	int m_nKeysChanged[256];		// keys with pressed/released set last frame
+	int m_nKeysChangedCount = 0;
+	bool m_bKeyDown[256] = { 0 };	// last state pushed by SetKeyState
+	bool m_bMouseDown[5] = { 0 };	// last state pushed by SetMouseState
+
+	// Present pipeline - Update draws into one buffer of the ring while the
+	// present thread outputs the frames submitted before it
+	static constexpr int MAX_FRAME_BUFFERS = 3;
+	unsigned char* m_bufFrames[MAX_FRAME_BUFFERS] = { nullptr };	// glyph plane followed by the attribute plane
+	sDirtyRegion m_dirtyFrames[MAX_FRAME_BUFFERS];
+	sDirtyRegion* m_dirty = nullptr;
+	float m_fFrameTime[MAX_FRAME_BUFFERS] = { 0.0f };
+	int m_nFrameBuffers = 2;
+	long long m_nFramesSubmitted = 0;
+	long long m_nFramesPresented = 0;
+	bool m_bPresentQuit = false;
+	std::thread m_presentThread;
+	std::mutex m_muxPresent;
+	std::condition_variable m_cvFrameSubmitted;
+	std::condition_variable m_cvFramePresented;
+
+	// Frame pacing
+	FRAME_PACING m_framePacing = PACING_UNCAPPED;
+	float m_fTargetFPS = 60.0f;
+	bool m_bHalfRateUnfocused = true;
+	float m_fSpinTail = 0.001f;		// seconds busy-waited at the end of a frame, sleeping isn't that precise
+
+	// Telemetry - timings of the last TELEMETRY_FRAMES frames. A frame is complete
+	// once its present time is known, which lags behind by the present ring
+	static constexpr int TELEMETRY_FRAMES = 1024;
+	std::vector<sFrameTiming> m_vecFrameTimings = std::vector<sFrameTiming>(TELEMETRY_FRAMES);
+	long long m_nTimingsRecorded = 0;
+	long long m_nTimingsComplete = 0;
+	float m_fPresentTime[MAX_FRAME_BUFFERS] = { 0.0f };
+	SPSCQueue<sFrameTiming, 4096> m_queueTelemetryCSV;
+	std::ofstream m_fileTelemetryCSV;
+	std::thread m_telemetryThread;
+	std::atomic<bool> m_bTelemetryQuit{ false };
+	std::atomic<long long> m_nTelemetryDropped{ 0 };
+
+	GlyphTable m_glyphTable;
+	FrameRecorder m_recorder;
+	SharedFrameBuffer m_sharedFrame;
+
+	// Tiled rendering - filled primitives are binned into tiles of the screen and
+	// rasterized by the worker pool, each tile drawing its commands in submission order
+	static constexpr int TILE_WIDTH = 32;
+	static constexpr int TILE_HEIGHT = 16;
+	bool m_bTiled = false;
+	WorkerPool m_tileWorkers;
+	std::vector<sDrawCommand> m_vecTileCommands;
+	std::vector<std::vector<int>> m_vecTileBins;	// indices into m_vecTileCommands, one list per tile
+	int m_nTilesX = 0;
+	int m_nTilesY = 0;
+
+	// Every primitive is clipped to m_clip once before it's drawn. PushClip saves
+	// the current one on the stack
+	sClipRect m_clip = { 0, 0, -1, -1 };
+	std::vector<sClipRect> m_vecClipStack;
+
+	// DrawMesh scratch - transformed vertices, one array per coordinate, and
+	// which sides of the clip rectangle each vertex is off
+	std::vector<int> m_vecMeshX;
+	std::vector<int> m_vecMeshY;
+	std::vector<unsigned char> m_vecMeshOutcodes;
+
+	// Span tables of circles, ellipses and triangles up to RASTER_CACHE_MAX_SIZE
+	// cells across, so drawing the same shape again only stores its spans.
+	// Triangles under RASTER_CACHE_MIN_SIZE both ways rasterize faster than
+	// they're looked up, and are never cached
+	static constexpr int RASTER_CACHE_MAX_SIZE = 64;
+	static constexpr int RASTER_CACHE_MIN_SIZE = 8;
+	RasterCache m_rasterCache;
+
+	// static thread variables - to handle window closing event
+	static std::mutex m_muxGame;
+	static std::condition_variable m_cvConditionVariable;
+	static std::atomic<bool> m_bIsRunning;
+
+	void GameThread()
+	{
+		if (!Setup())
+			m_bIsRunning = false;
+
+		auto dt1 = std::chrono::steady_clock::now();
+		auto dt2 = std::chrono::steady_clock::now();
+		auto tpNextFrame = dt1;
+
+#ifdef _WIN32
+		// Default timer resolution is ~15.6ms, far too coarse to sleep between frames
+		if (m_framePacing == PACING_FIXED)
+			timeBeginPeriod(1);
+#endif
+
+		if (m_nFrameBuffers > 1)
+		{
+			m_bPresentQuit = false;
+			m_presentThread = std::thread(&CrabbyGraphics::PresentThread, this);
+		}
+
+		m_bInputQuit = false;
+		m_inputThread = std::thread(&CrabbyGraphics::InputThread, this);
+
+		while (m_bIsRunning)
+		{
+			while (m_bIsRunning)
+			{
+				dt2 = std::chrono::steady_clock::now();
+				std::chrono::duration<float> elapsedTime = dt2 - dt1;
+				dt1 = dt2;
+				float fElapsedTime = elapsedTime.count();
+
+				ProcessInputEvents();
+
+				auto tpUpdate = std::chrono::steady_clock::now();
+				if (!Update(fElapsedTime))
+					m_bIsRunning = false;
+				FlushTiles();
+				m_rasterCache.NextFrame();
+
+				// Hand the finished frame to the present thread and carry on
+				// drawing into the next buffer
+				auto tpSubmit = std::chrono::steady_clock::now();
+				if (m_recorder.IsRecording())
+					m_recorder.RecordFrame(m_bufGlyphs, m_bufAttributes, m_glyphTable, *m_dirty, fElapsedTime);
+				SubmitFrame(fElapsedTime);
+
+				std::chrono::duration<float> inputTime = tpUpdate - dt2;
+				std::chrono::duration<float> updateTime = tpSubmit - tpUpdate;
+				std::chrono::duration<float> submitTime = std::chrono::steady_clock::now() - tpSubmit;
+				RecordFrameTiming(inputTime.count(), updateTime.count(), submitTime.count(), fElapsedTime);
+				if (m_nFrameBuffers == 1)
+					CompleteFrameTiming(m_nTimingsRecorded - 1, m_fPresentTime[0]);
+
+				WaitForNextFrame(tpNextFrame);
+			}
+
+			// Contol reaches here if window close event occurs
+			if (Destroy()) {
+#ifdef _WIN32
+				if (m_framePacing == PACING_FIXED)
+					timeEndPeriod(1);
+#endif
+				StopInputThread();
+				StopPresentThread();
+				StopTelemetryCSV();
+				m_recorder.Stop();
+				m_sharedFrame.Close();
+				m_tileWorkers.Stop();
+				FreeFrameBuffers();
+#ifdef _WIN32
+				SetConsoleActiveScreenBuffer(m_hConsole);
+#else
+				RestoreTerminal();
+#endif
+				m_cvConditionVariable.notify_one();
+			}
+			else {
+				m_bIsRunning = true;
+			}
+		}
+	}
+
+	// Sleeps until tpNextFrame moves one frame on, then spins the last m_fSpinTail
+	// seconds. Runs at half the target rate while the console isn't focused.
+	// A frame which overran just starts the next one, no catching up
+	void WaitForNextFrame(std::chrono::steady_clock::time_point& tpNextFrame)
+	{
+		if (m_framePacing == PACING_UNCAPPED)
+			return;
+
+		float fFrameRate = (m_bHalfRateUnfocused && !m_bIsConsoleInFocus) ? m_fTargetFPS / 2.0f : m_fTargetFPS;
+		tpNextFrame += std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<float>(1.0f / fFrameRate));
+
+		auto tpNow = std::chrono::steady_clock::now();
+		if (tpNextFrame <= tpNow)
+		{
+			tpNextFrame = tpNow;
+			return;
+		}
+
+		auto spinTail = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<float>(m_fSpinTail));
+		if (tpNextFrame - tpNow > spinTail)
+			std::this_thread::sleep_until(tpNextFrame - spinTail);
+
+		while (std::chrono::steady_clock::now() < tpNextFrame)
+			std::this_thread::yield();
+	}
+
+	void AllocateFrameBuffers(int nBuffers)
+	{
+		for (int i = 0; i < nBuffers; i++)
+		{
+			m_bufFrames[i] = new unsigned char[2 * m_screenWidth * m_screenHeight];
+
+			// Initalize all values to zero
+			memset(m_bufFrames[i], 0, 2 * m_screenWidth * m_screenHeight);
+			m_dirtyFrames[i].Reset(m_screenWidth, m_screenHeight);
+		}
+
+#ifdef _WIN32
+		m_bufPresentCells = new CHAR_INFO[m_screenWidth * m_screenHeight];
+#endif
+
+		SelectFrameBuffer(m_bufFrames[0]);
+		m_dirty = &m_dirtyFrames[0];
+
+		m_clip = { 0, 0, m_screenWidth - 1, m_screenHeight - 1 };
+		m_vecClipStack.clear();
+
+		m_nTilesX = (m_screenWidth + TILE_WIDTH - 1) / TILE_WIDTH;
+		m_nTilesY = (m_screenHeight + TILE_HEIGHT - 1) / TILE_HEIGHT;
+		m_vecTileBins.assign(m_nTilesX * m_nTilesY, {});
+		m_vecTileCommands.clear();
+		m_nTimingsRecorded = 0;
+		m_nTimingsComplete = 0;
+
+		// Nothing has been presented yet, so the first frame goes out whole
+		MarkAllDirty();
+		m_nFramesSubmitted = 0;
+		m_nFramesPresented = 0;
+	}
+
+	void FreeFrameBuffers()
+	{
+		for (int i = 0; i < MAX_FRAME_BUFFERS; i++)
+		{
+			delete[] m_bufFrames[i];
+			m_bufFrames[i] = nullptr;
+		}
+
+#ifdef _WIN32
+		delete[] m_bufPresentCells;
+		m_bufPresentCells = nullptr;
+#endif
+
+		m_bufGlyphs = nullptr;
+		m_bufAttributes = nullptr;
+	}
+
+	// Points the screen planes at one buffer of the ring
+	void SelectFrameBuffer(unsigned char* bufFrame)
+	{
+		m_bufGlyphs = bufFrame;
+		m_bufAttributes = bufFrame + m_screenWidth * m_screenHeight;
+	}
+
+	// Calls span(x1, x2, y) for each row of the inside of a triangle within the
+	// rectangle (inclusive)
+	template <typename F>
+	void TriangleSpans(const int* cornersX, const int* cornersY, int x1, int y1, int x2, int y2, F span)
+	{
+		// One integer edge function per edge, A * x + B * y + C, which is
+		// positive inside the triangle once the corners wind clockwise on
+		// screen. Cells on an edge belong to the triangle only if it's a top
+		// or left edge, so triangles sharing an edge don't both draw it. A
+		// triangle with no area has no inside, only its outline
+		int px[3] = { cornersX[0], cornersX[1], cornersX[2] };
+		int py[3] = { cornersY[0], cornersY[1], cornersY[2] };
+		long long nArea = (long long)(px[1] - px[0]) * (py[2] - py[0]) - (long long)(py[1] - py[0]) * (px[2] - px[0]);
+		if (nArea < 0)
+		{
+			std::swap(px[1], px[2]);
+			std::swap(py[1], py[2]);
+		}
+
+		long long A[3], B[3], C[3];
+		for (int e = 0; e < 3; e++)
+		{
+			int dx = px[(e + 1) % 3] - px[e], dy = py[(e + 1) % 3] - py[e];
+			bool bTopLeft = dy < 0 || (dy == 0 && dx > 0);
+			A[e] = -dy;
+			B[e] = dx;
+			C[e] = (long long)dy * px[e] - (long long)dx * py[e] - (bTopLeft ? 0 : 1);
+		}
+
+		auto FloorDiv = [](long long n, long long d) { return n >= 0 ? n / d : -((-n + d - 1) / d); };
+
+		// Each row is solved for the span where all three are >= 0 instead of
+		// testing every cell of the bounding box
+		for (int y = y1; y <= y2; y++)
+		{
+			long long sx1 = x1, sx2 = x2;
+			for (int e = 0; e < 3; e++)
+			{
+				long long c = B[e] * y + C[e];
+				if (A[e] > 0)
+					sx1 = (std::max)(sx1, -FloorDiv(c, A[e]));
+				else if (A[e] < 0)
+					sx2 = (std::min)(sx2, FloorDiv(c, -A[e]));
+				else if (c < 0)
+					sx2 = sx1 - 1;
+			}
+
+			if (sx1 <= sx2)
+				span((int)sx1, (int)sx2, y);
+		}
+	}
+
+	// Rasterizes the part of a command inside the clip rectangle (inclusive).
+	// Nothing is marked dirty here, the command's bounds were when it was drawn
+	void RasterizeCommand(const sDrawCommand& cmd, int cx1, int cy1, int cx2, int cy2)
+	{
+		int x1 = (std::max)(cmd.x1, cx1), x2 = (std::min)(cmd.x2, cx2);
+		int y1 = (std::max)(cmd.y1, cy1), y2 = (std::min)(cmd.y2, cy2);
+		if (x1 > x2 || y1 > y2)
+			return;
+
+		auto FillSpan = [&](int sx1, int sx2, int y)
+		{
+			sx1 = (std::max)(sx1, x1);
+			sx2 = (std::min)(sx2, x2);
+			if (y < y1 || y > y2 || sx1 > sx2)
+				return;
+
+			std::fill_n(m_bufGlyphs + y * m_screenWidth + sx1, sx2 - sx1 + 1, cmd.nGlyph);
+			std::fill_n(m_bufAttributes + y * m_screenWidth + sx1, sx2 - sx1 + 1, cmd.nAttributes);
+		};
+
+		// A triangle's outline, with the same lines as DrawTriangle
+		auto DrawEdges = [&]()
+		{
+			auto Plot = [&](int x, int y)
+			{
+				m_bufGlyphs[y * m_screenWidth + x] = cmd.nGlyph;
+				m_bufAttributes[y * m_screenWidth + x] = cmd.nEdgeAttributes;
+			};
+
+			for (int e = 0; e < 3; e++)
+				TraceLine({ cmd.px[e], cmd.py[e] }, { cmd.px[(e + 1) % 3], cmd.py[(e + 1) % 3] }, x1, y1, x2, y2, Plot);
+		};
+
+		switch (cmd.type)
+		{
+		case DRAW_FILL:
+			// Spans of whole rows join up into a single fill
+			if (x1 == 0 && x2 == m_screenWidth - 1)
+			{
+				std::fill_n(m_bufGlyphs + y1 * m_screenWidth, (y2 - y1 + 1) * m_screenWidth, cmd.nGlyph);
+				std::fill_n(m_bufAttributes + y1 * m_screenWidth, (y2 - y1 + 1) * m_screenWidth, cmd.nAttributes);
+			}
+			else
+				for (int y = y1; y <= y2; y++)
+					FillSpan(x1, x2, y);
+			break;
+
+		case DRAW_FILL_TRIANGLE:
+			TriangleSpans(cmd.px, cmd.py, x1, y1, x2, y2, FillSpan);
+
+			// The outline is drawn over the inside
+			if (cmd.bOutline)
+				DrawEdges();
+			break;
+
+		case DRAW_TRIANGLE_EDGES:
+			DrawEdges();
+			break;
+
+		case DRAW_LINE:
+			TraceLine({ cmd.px[0], cmd.py[0] }, { cmd.px[1], cmd.py[1] }, x1, y1, x2, y2, [&](int x, int y)
+			{
+				m_bufGlyphs[y * m_screenWidth + x] = cmd.nGlyph;
+				m_bufAttributes[y * m_screenWidth + x] = cmd.nAttributes;
+			});
+			break;
+
+		case DRAW_SPANS:
+			for (int i = 0; i < cmd.nSpans; i++)
+			{
+				int y = cmd.py[0] + cmd.pSpans[i].dy;
+				int sx1 = (std::max)(cmd.px[0] + cmd.pSpans[i].x1, x1);
+				int sx2 = (std::min)(cmd.px[0] + cmd.pSpans[i].x2, x2);
+				if (y < y1 || y > y2 || sx1 > sx2)
+					continue;
+
+				// Most of an outline's spans are a cell or two, cheaper stored directly
+				unsigned char nAttributes = cmd.pSpans[i].bEdge ? cmd.nEdgeAttributes : cmd.nAttributes;
+				if (sx2 - sx1 < 8)
+				{
+					for (int x = sx1; x <= sx2; x++)
+					{
+						m_bufGlyphs[y * m_screenWidth + x] = cmd.nGlyph;
+						m_bufAttributes[y * m_screenWidth + x] = nAttributes;
+					}
+				}
+				else
+				{
+					std::fill_n(m_bufGlyphs + y * m_screenWidth + sx1, sx2 - sx1 + 1, cmd.nGlyph);
+					std::fill_n(m_bufAttributes + y * m_screenWidth + sx1, sx2 - sx1 + 1, nAttributes);
+				}
+			}
+			break;
+		}
+	}
+
+	// Draws a primitive inside the clip rectangle, or bins it into every tile its
+	// clipped bounds touch when tiled rendering is on
+	void DrawCommand(sDrawCommand cmd)
+	{
+		cmd.x1 = (std::max)(cmd.x1, m_clip.x1);
+		cmd.y1 = (std::max)(cmd.y1, m_clip.y1);
+		cmd.x2 = (std::min)(cmd.x2, m_clip.x2);
+		cmd.y2 = (std::min)(cmd.y2, m_clip.y2);
+		if (cmd.x1 > cmd.x2 || cmd.y1 > cmd.y2)
+			return;
+
+		if (cmd.type == DRAW_FILL_TRIANGLE || cmd.type == DRAW_TRIANGLE_EDGES)
+			CacheTriangle(cmd);
+
+		MarkDirty({ cmd.x1, cmd.y1 }, { cmd.x2, cmd.y2 });
+
+		if (!m_bTiled)
+		{
+			RasterizeCommand(cmd, 0, 0, m_screenWidth - 1, m_screenHeight - 1);
+			return;
+		}
+
+		int nCommand = (int)m_vecTileCommands.size();
+		m_vecTileCommands.push_back(cmd);
+		for (int ty = cmd.y1 / TILE_HEIGHT; ty <= cmd.y2 / TILE_HEIGHT; ty++)
+			for (int tx = cmd.x1 / TILE_WIDTH; tx <= cmd.x2 / TILE_WIDTH; tx++)
+				m_vecTileBins[ty * m_nTilesX + tx].push_back(nCommand);
+	}
+
+	// Turns a triangle command into a DRAW_SPANS one from the raster cache, if
+	// it's small enough and the cache is on. The spans are anchored at the first
+	// corner, rasterizing doesn't change when a triangle moves by whole cells
+	void CacheTriangle(sDrawCommand& cmd)
+	{
+		int nMinX = (std::min)((std::min)(cmd.px[0], cmd.px[1]), cmd.px[2]), nMaxX = (std::max)((std::max)(cmd.px[0], cmd.px[1]), cmd.px[2]);
+		int nMinY = (std::min)((std::min)(cmd.py[0], cmd.py[1]), cmd.py[2]), nMaxY = (std::max)((std::max)(cmd.py[0], cmd.py[1]), cmd.py[2]);
+		if (m_rasterCache.Capacity() == 0 || nMaxX - nMinX >= RASTER_CACHE_MAX_SIZE || nMaxY - nMinY >= RASTER_CACHE_MAX_SIZE ||
+			(nMaxX - nMinX < RASTER_CACHE_MIN_SIZE && nMaxY - nMinY < RASTER_CACHE_MIN_SIZE))
+			return;
+
+		bool bFill = cmd.type == DRAW_FILL_TRIANGLE;
+		bool bEdges = cmd.type == DRAW_TRIANGLE_EDGES || cmd.bOutline;
+		int px[3], py[3];
+		for (int i = 0; i < 3; i++)
+		{
+			px[i] = cmd.px[i] - cmd.px[0];
+			py[i] = cmd.py[i] - cmd.py[0];
+		}
+
+		sRasterKey key = { RASTER_TRIANGLE, { px[1], py[1], px[2], py[2], (bFill ? 1 : 0) | (bEdges ? 2 : 0) } };
+		const std::vector<sShapeSpan>* pSpans = m_rasterCache.Find(key);
+		if (!pSpans)
+		{
+			if (!m_rasterCache.HasRoom() || !m_rasterCache.Admit(key))
+				return;
+
+			if (m_vecTileCommands.empty())
+				m_rasterCache.Trim();
+
+			std::vector<sShapeSpan>& vecSpans = m_rasterCache.Insert(key);
+			int x1 = nMinX - cmd.px[0], y1 = nMinY - cmd.py[0], x2 = nMaxX - cmd.px[0], y2 = nMaxY - cmd.py[0];
+			if (bFill)
+				TriangleSpans(px, py, x1, y1, x2, y2, [&](int sx1, int sx2, int y) { vecSpans.push_back({ y, sx1, sx2, false }); });
+
+			if (bEdges)
+			{
+				std::vector<std::pair<int, int>> vecCells;
+				for (int e = 0; e < 3; e++)
+					TraceLine({ px[e], py[e] }, { px[(e + 1) % 3], py[(e + 1) % 3] }, x1, y1, x2, y2, [&](int x, int y) { vecCells.push_back({ y, x }); });
+				AppendSpans(vecCells, false, true, vecSpans);
+			}
+			pSpans = &vecSpans;
+		}
+
+		cmd.type = DRAW_SPANS;
+		cmd.pSpans = pSpans->data();
+		cmd.nSpans = (int)pSpans->size();
+	}
+
+	// Queues the current buffer for presenting and switches the screen planes to
+	// the next buffer in the ring, waiting only if the present thread is a whole
+	// ring behind. The finished frame is copied across since games build on the
+	// previous frame (Flappy Bird's game over screen)
+	void SubmitFrame(float fElapsedTime)
+	{
+		if (m_nFrameBuffers == 1)
+		{
+			auto tpPresent = std::chrono::steady_clock::now();
+			PresentFrame(m_bufGlyphs, *m_dirty, fElapsedTime);
+			if (m_sharedFrame.IsOpen())
+				m_sharedFrame.Publish(m_bufGlyphs, m_bufAttributes, m_glyphTable, fElapsedTime);
+			std::chrono::duration<float> presentTime = std::chrono::steady_clock::now() - tpPresent;
+			m_fPresentTime[0] = presentTime.count();
+
+			m_dirty->Reset(m_screenWidth, m_screenHeight);
+			return;
+		}
+
+		unsigned char* bufFinished = m_bufGlyphs;
+		int nNext;
+		{
+			std::unique_lock<std::mutex> ul(m_muxPresent);
+			m_fFrameTime[m_nFramesSubmitted % m_nFrameBuffers] = fElapsedTime;
+			m_nFramesSubmitted++;
+			m_cvFrameSubmitted.notify_one();
+
+			m_cvFramePresented.wait(ul, [&] { return m_nFramesSubmitted - m_nFramesPresented < m_nFrameBuffers; });
+			nNext = (int)(m_nFramesSubmitted % m_nFrameBuffers);
+
+			// The frame which used this buffer last has been presented now
+			if (m_nFramesSubmitted >= m_nFrameBuffers)
+				CompleteFrameTiming(m_nFramesSubmitted - m_nFrameBuffers, m_fPresentTime[nNext]);
+		}
+
+		memcpy(m_bufFrames[nNext], bufFinished, 2 * m_screenWidth * m_screenHeight);
+		SelectFrameBuffer(m_bufFrames[nNext]);
+
+		// The copy matches what has been submitted, so only what gets drawn from
+		// here on needs presenting
+		m_dirty = &m_dirtyFrames[nNext];
+		m_dirty->Reset(m_screenWidth, m_screenHeight);
+	}
+
+	void PresentThread()
+	{
+		while (true)
+		{
+			int nFrame;
+			float fElapsedTime;
+			{
+				std::unique_lock<std::mutex> ul(m_muxPresent);
+				m_cvFrameSubmitted.wait(ul, [&] { return m_bPresentQuit || m_nFramesPresented < m_nFramesSubmitted; });
+				if (m_nFramesPresented == m_nFramesSubmitted)
+					return;
+
+				nFrame = (int)(m_nFramesPresented % m_nFrameBuffers);
+				fElapsedTime = m_fFrameTime[nFrame];
+			}
+
+			auto tpPresent = std::chrono::steady_clock::now();
+			PresentFrame(m_bufFrames[nFrame], m_dirtyFrames[nFrame], fElapsedTime);
+			if (m_sharedFrame.IsOpen())
+				m_sharedFrame.Publish(m_bufFrames[nFrame], m_bufFrames[nFrame] + m_screenWidth * m_screenHeight, m_glyphTable, fElapsedTime);
+			std::chrono::duration<float> presentTime = std::chrono::steady_clock::now() - tpPresent;
+
+			{
+				std::unique_lock<std::mutex> ul(m_muxPresent);
+				m_fPresentTime[nFrame] = presentTime.count();
+				m_nFramesPresented++;
+			}
+			m_cvFramePresented.notify_one();
+		}
+	}
+
+	// Lets the present thread output whatever is still queued, then joins it
+	void StopPresentThread()
+	{
+		if (!m_presentThread.joinable())
+			return;
+
+		{
+			std::unique_lock<std::mutex> ul(m_muxPresent);
+			m_bPresentQuit = true;
+		}
+		m_cvFrameSubmitted.notify_one();
+		m_presentThread.join();
+	}
+
+	// Draw onto screen - only the dirty part of the frame is written out.
+	// bufFrame is a buffer of the ring, the glyph plane followed by the attribute plane
+	void PresentFrame(const unsigned char* bufFrame, const sDirtyRegion& dirty, float fElapsedTime)
+	{
+		const unsigned char* bufAttributes = bufFrame + m_screenWidth * m_screenHeight;
+#ifdef _WIN32
+		if (!dirty.IsEmpty())
+		{
+			short nMinX = (short)*std::min_element(dirty.vecMinX.begin() + dirty.nMinY, dirty.vecMinX.begin() + dirty.nMaxY + 1);
+			short nMaxX = (short)*std::max_element(dirty.vecMaxX.begin() + dirty.nMinY, dirty.vecMaxX.begin() + dirty.nMaxY + 1);
+
+			// The console only takes its own cell format, convert the rectangle being written
+			for (int y = dirty.nMinY; y <= dirty.nMaxY; y++)
+			{
+				for (int i = y * m_screenWidth + nMinX; i <= y * m_screenWidth + nMaxX; i++)
+				{
+					m_bufPresentCells[i].Char.UnicodeChar = m_glyphTable.Glyph(bufFrame[i]);
+					m_bufPresentCells[i].Attributes = bufAttributes[i];
+				}
+			}
+
+			SMALL_RECT rectDirty = { nMinX, (short)dirty.nMinY, nMaxX, (short)dirty.nMaxY };
+			WriteConsoleOutput(m_hConsole, m_bufPresentCells, { (short)m_screenWidth, (short)m_screenHeight }, { nMinX, (short)dirty.nMinY }, &rectDirty);
+		}
+
+		wchar_t s[256];
+		swprintf_s(s, 256, L"Console : %d FPS", (int)(1.0f / fElapsedTime));
+		SetConsoleTitle(s);
+#else
+		char s[256];
+		snprintf(s, 256, "Console : %d FPS", (int)(1.0f / fElapsedTime));
+		PresentFrameVT(bufFrame, bufAttributes, dirty, s);
+#endif
+	}
+
+	void PushInputEvent(INPUT_EVENT type, int nCode, bool bDown, int x = 0, int y = 0)
+	{
+		if (!m_queueInput.Push({ type, nCode, bDown, x, y, std::chrono::steady_clock::now() }))
+			m_nInputDropped++;
+	}
+
+	// Turns the queued input events into pressed/held/released states, only
+	// touching the keys which changed. A key pressed and released within the same
+	// frame reports both. Shared by the game thread and the headless runner
+	void ProcessInputEvents()
+	{
+		for (int i = 0; i < m_nKeysChangedCount; i++)
+		{
+			m_keys[m_nKeysChanged[i]].bPressed = false;
+			m_keys[m_nKeysChanged[i]].bReleased = false;
+		}
+		m_nKeysChangedCount = 0;
+
+		for (int m = 0; m < 5; m++)
+		{
+			m_mouse[m].bPressed = false;
+			m_mouse[m].bReleased = false;
+		}
+
+		sInputEvent e;
+		while (m_queueInput.Pop(e))
+		{
+			switch (e.type)
+			{
+			case EVENT_KEY:
+			case EVENT_MOUSE_BUTTON:
+			{
+				if (e.type == EVENT_KEY && (e.nCode < 0 || e.nCode >= 256))
+					break;
+				if (e.type == EVENT_MOUSE_BUTTON && (e.nCode < 0 || e.nCode >= 5))
+					break;
+
+				sKeyState& state = e.type == EVENT_KEY ? m_keys[e.nCode] : m_mouse[e.nCode];
+				if (e.bDown == state.bHeld)
+					break;		// auto-repeat or a release we never saw the press of
+
+				if (e.type == EVENT_KEY && !state.bPressed && !state.bReleased)
+					m_nKeysChanged[m_nKeysChangedCount++] = e.nCode;
+
+				if (e.bDown)
+					state.bPressed = true;
+				else
+					state.bReleased = true;
+				state.bHeld = e.bDown;
+			}
+			break;
 
-				// TODO: Handle Inputs
-				// Handle Keyboard Input
-				for (int i = 0; i < 256; i++)
-				{
-					m_keyNewState[i] = GetAsyncKeyState(i);
+			case EVENT_MOUSE_MOVE:
+				m_mousePosX = e.x;
+				m_mousePosY = e.y;
+				break;
 
-					m_keys[i].bPressed = false;
-					m_keys[i].bReleased = false;
+			case EVENT_FOCUS:
+				m_bIsConsoleInFocus = e.bDown;
+				break;
+			}
+		}
+	}
 
-					if (m_keyNewState[i] != m_keyOldState[i])
-					{
-						if (m_keyNewState[i] & 0x8000)
-						{
-							m_keys[i].bPressed = !m_keys[i].bHeld;
-							m_keys[i].bHeld = true;
-						}
-						else
-						{
-							m_keys[i].bReleased = true;
-							m_keys[i].bHeld = false;
-						}
-					}
+	void StopInputThread()
+	{
+		if (!m_inputThread.joinable())
+			return;
 
-					m_keyOldState[i] = m_keyNewState[i];
-				}
+		m_bInputQuit = true;
+		m_inputThread.join();
+	}
+
+#ifdef _WIN32
+	// Waits on the console input handle and translates console input records
+	void InputThread()
+	{
+		INPUT_RECORD inBuf[128];
+		DWORD dwLastButtonState = 0;
+
+		while (!m_bInputQuit)
+		{
+			if (WaitForSingleObject(m_hConsoleInput, 10) != WAIT_OBJECT_0)
+				continue;
 
-				// Handle Mouse Input - Check for window events
-				INPUT_RECORD inBuf[32];
-				DWORD events = 0;
-				GetNumberOfConsoleInputEvents(m_hConsoleInput, &events);
-				if (events > 0)
-					ReadConsoleInput(m_hConsoleInput, inBuf, events, &events);
+			DWORD events = 0;
+			if (!ReadConsoleInput(m_hConsoleInput, inBuf, 128, &events))
+				continue;
 
-				// Handle events - we only care about mouse clicks and movement
-				// for now
-				for (DWORD i = 0; i < events; i++)
+			for (DWORD i = 0; i < events; i++)
+			{
+				switch (inBuf[i].EventType)
 				{
-					switch (inBuf[i].EventType)
-					{
-					case FOCUS_EVENT:
-					{
-						m_bIsConsoleInFocus = inBuf[i].Event.FocusEvent.bSetFocus;
-					}
+				case KEY_EVENT:
+					PushInputEvent(EVENT_KEY, inBuf[i].Event.KeyEvent.wVirtualKeyCode, inBuf[i].Event.KeyEvent.bKeyDown);
+					break;
+
+				case FOCUS_EVENT:
+					PushInputEvent(EVENT_FOCUS, 0, inBuf[i].Event.FocusEvent.bSetFocus);
 					break;
 
-					case MOUSE_EVENT:
+				case MOUSE_EVENT:
+				{
+					const MOUSE_EVENT_RECORD& mouse = inBuf[i].Event.MouseEvent;
+					switch (mouse.dwEventFlags)
 					{
-						switch (inBuf[i].Event.MouseEvent.dwEventFlags)
-						{
-						case MOUSE_MOVED:
-						{
-							m_mousePosX = inBuf[i].Event.MouseEvent.dwMousePosition.X;
-							m_mousePosY = inBuf[i].Event.MouseEvent.dwMousePosition.Y;
-						}
+					case MOUSE_MOVED:
+						PushInputEvent(EVENT_MOUSE_MOVE, 0, false, mouse.dwMousePosition.X, mouse.dwMousePosition.Y);
 						break;
 
-						case 0:
+					case 0:
+					case DOUBLE_CLICK:
+						for (int m = 0; m < 5; m++)
 						{
-							for (int m = 0; m < 5; m++)
-								m_mouseNewState[m] = (inBuf[i].Event.MouseEvent.dwButtonState & (1 << m)) > 0;
-
+							if ((mouse.dwButtonState ^ dwLastButtonState) & (1 << m))
+								PushInputEvent(EVENT_MOUSE_BUTTON, m, (mouse.dwButtonState & (1 << m)) != 0, mouse.dwMousePosition.X, mouse.dwMousePosition.Y);
 						}
+						dwLastButtonState = mouse.dwButtonState;
 						break;
 
-						default:
-							break;
-						}
-					}
-					break;
-
 					default:
 						break;
-						// We don't care just at the moment
 					}
 				}
+				break;
+
+				default:
+					break;
+					// We don't care just at the moment
+				}
+			}
+		}
+	}
+#else
+	// Terminals only send bytes when a key goes down (and again on auto-repeat),
+	// so a key counts as held until it hasn't been seen for a while. The first
+	// wait has to outlast the usual auto-repeat delay
+	static constexpr float KEY_RELEASE_FIRST = 0.55f;
+	static constexpr float KEY_RELEASE_REPEAT = 0.1f;
+
+	// Reads the raw mode terminal, parsing keys, arrow keys, SGR mouse reports
+	// and focus in/out reports
+	void InputThread()
+	{
+		using clock = std::chrono::steady_clock;
+		clock::time_point tpReleaseAt[256];
+		bool bHeld[256] = { 0 };
+		unsigned char buf[256];
+		std::string pending;
+
+		auto KeyDown = [&](int nKey) {
+			auto tpNow = clock::now();
+			float fWait = bHeld[nKey] ? KEY_RELEASE_REPEAT : KEY_RELEASE_FIRST;
+			if (!bHeld[nKey])
+				PushInputEvent(EVENT_KEY, nKey, true);
+			bHeld[nKey] = true;
+			tpReleaseAt[nKey] = tpNow + std::chrono::duration_cast<clock::duration>(std::chrono::duration<float>(fWait));
+		};
+
+		while (!m_bInputQuit)
+		{
+			pollfd pfd = { STDIN_FILENO, POLLIN, 0 };
+			if (poll(&pfd, 1, 10) > 0 && (pfd.revents & POLLIN))
+			{
+				ssize_t n = read(STDIN_FILENO, buf, sizeof(buf));
+				if (n > 0)
+					pending.append((const char*)buf, n);
 
-				for (int m = 0; m < 5; m++)
+				size_t i = 0;
+				while (i < pending.size())
 				{
-					m_mouse[m].bPressed = false;
-					m_mouse[m].bReleased = false;
+					size_t nUsed = ParseTerminalInput(pending, i, KeyDown);
+					if (nUsed == 0)
+						break;		// incomplete escape sequence, wait for the rest
+					i += nUsed;
+				}
+				pending.erase(0, i);
 
-					if (m_mouseNewState[m] != m_mouseOldState[m])
-					{
-						if (m_mouseNewState[m])
-						{
-							m_mouse[m].bPressed = true;
-							m_mouse[m].bHeld = true;
-						}
-						else
-						{
-							m_mouse[m].bReleased = true;
-							m_mouse[m].bHeld = false;
-						}
-					}
+				// A lone ESC with nothing following it is the escape key
+				if (pending == "\x1b" && poll(&pfd, 1, 0) == 0)
+				{
+					KeyDown(VK_ESCAPE);
+					pending.clear();
+				}
+			}
 
-					m_mouseOldState[m] = m_mouseNewState[m];
+			auto tpNow = clock::now();
+			for (int k = 0; k < 256; k++)
+			{
+				if (bHeld[k] && tpNow >= tpReleaseAt[k])
+				{
+					bHeld[k] = false;
+					PushInputEvent(EVENT_KEY, k, false);
 				}
+			}
+		}
+	}
 
+	// Parses one key or escape sequence starting at in[i]. Returns the number of
+	// bytes used, or 0 if the sequence isn't complete yet
+	template <typename F>
+	size_t ParseTerminalInput(const std::string& in, size_t i, F& KeyDown)
+	{
+		unsigned char c = in[i];
 
-				if (!Update(fElapsedTime))
-					m_bIsRunning = false;
+		if (c != 0x1b)
+		{
+			if (c >= 'a' && c <= 'z') KeyDown(c - 'a' + 'A');
+			else if (c >= 'A' && c <= 'Z') KeyDown(c);
+			else if (c >= '0' && c <= '9') KeyDown(c);
+			else if (c == ' ') KeyDown(VK_SPACE);
+			else if (c == '\r' || c == '\n') KeyDown(VK_RETURN);
+			else if (c == '\t') KeyDown(VK_TAB);
+			else if (c == 0x7f || c == 0x08) KeyDown(VK_BACK);
+			return 1;
+		}
 
-				// Draw onto screen
-				wchar_t s[256];
-				swprintf_s(s, 256, L"Console : %d FPS", (int)(1.0f / fElapsedTime));
-				SetConsoleTitle(s);
-				WriteConsoleOutput(m_hConsole, m_bufScreenData, { (short)m_screenWidth, (short)m_screenHeight }, { 0,0 }, &m_rectWindow);
-			}
+		if (i + 1 >= in.size())
+			return 0;
 
-			// Contol reaches here if window close event occurs
-			if (Destroy()) {
-				delete[] m_bufScreenData;
-				SetConsoleActiveScreenBuffer(m_hConsole);
-				m_cvConditionVariable.notify_one();
+		// ESC O x - cursor keys in application mode
+		if (in[i + 1] == 'O')
+		{
+			if (i + 2 >= in.size())
+				return 0;
+			ParseCursorKey(in[i + 2], KeyDown);
+			return 3;
+		}
+
+		if (in[i + 1] != '[')
+		{
+			KeyDown(VK_ESCAPE);
+			return 1;
+		}
+
+		// CSI - parameters up to the final byte
+		size_t end = i + 2;
+		while (end < in.size() && !(in[end] >= 0x40 && in[end] <= 0x7e))
+			end++;
+		if (end >= in.size())
+			return 0;
+
+		char cFinal = in[end];
+		std::string params = in.substr(i + 2, end - i - 2);
+
+		if (!params.empty() && params[0] == '<' && (cFinal == 'M' || cFinal == 'm'))
+		{
+			// SGR mouse report - ESC [ < button ; x ; y M (pressed/moved) or m (released)
+			int b = 0, x = 0, y = 0;
+			if (sscanf(params.c_str() + 1, "%d;%d;%d", &b, &x, &y) == 3)
+			{
+				PushInputEvent(EVENT_MOUSE_MOVE, 0, false, x - 1, y - 1);
+
+				// Terminal buttons are left, middle, right. Console ones are left, right, middle
+				static const int buttonMap[3] = { 0, 2, 1 };
+				if (!(b & 32) && !(b & 64) && (b & 3) < 3)
+					PushInputEvent(EVENT_MOUSE_BUTTON, buttonMap[b & 3], cFinal == 'M', x - 1, y - 1);
 			}
-			else {
-				m_bIsRunning = true;
+		}
+		else if (cFinal == 'I' && params.empty())
+			PushInputEvent(EVENT_FOCUS, 0, true);
+		else if (cFinal == 'O' && params.empty())
+			PushInputEvent(EVENT_FOCUS, 0, false);
+		else
+			ParseCursorKey(cFinal, KeyDown);
+
+		return end - i + 1;
+	}
+
+	template <typename F>
+	static void ParseCursorKey(char c, F& KeyDown)
+	{
+		switch (c)
+		{
+		case 'A': KeyDown(VK_UP); break;
+		case 'B': KeyDown(VK_DOWN); break;
+		case 'C': KeyDown(VK_RIGHT); break;
+		case 'D': KeyDown(VK_LEFT); break;
+		default: break;
+		}
+	}
+#endif
+
+	void RecordFrameTiming(float fInput, float fUpdate, float fSubmit, float fFrame)
+	{
+		sFrameTiming& timing = m_vecFrameTimings[m_nTimingsRecorded % TELEMETRY_FRAMES];
+		timing.nFrame = m_nTimingsRecorded;
+		timing.fPhase[PHASE_INPUT] = fInput;
+		timing.fPhase[PHASE_UPDATE] = fUpdate;
+		timing.fPhase[PHASE_SUBMIT] = fSubmit;
+		timing.fPhase[PHASE_PRESENT] = 0.0f;
+		timing.fPhase[PHASE_FRAME] = fFrame;
+		m_nTimingsRecorded++;
+	}
+
+	// Fills in the present time of a recorded frame and passes it on to the CSV writer
+	void CompleteFrameTiming(long long nFrame, float fPresent)
+	{
+		if (nFrame < 0 || nFrame < m_nTimingsRecorded - TELEMETRY_FRAMES)
+			return;
+
+		sFrameTiming& timing = m_vecFrameTimings[nFrame % TELEMETRY_FRAMES];
+		timing.fPhase[PHASE_PRESENT] = fPresent;
+		m_nTimingsComplete = nFrame + 1;
+
+		if (m_telemetryThread.joinable() && !m_queueTelemetryCSV.Push(timing))
+			m_nTelemetryDropped++;
+	}
+
+	// Writes queued frame timings to the CSV file a few times per second, so the
+	// game thread never waits on the disk
+	void TelemetryThread()
+	{
+		auto WriteQueued = [&]() {
+			sFrameTiming timing;
+			while (m_queueTelemetryCSV.Pop(timing))
+			{
+				m_fileTelemetryCSV << timing.nFrame;
+				for (int i = 0; i < PHASE_COUNT; i++)
+					m_fileTelemetryCSV << ',' << timing.fPhase[i] * 1000.0f;
+				m_fileTelemetryCSV << '\n';
 			}
+			m_fileTelemetryCSV.flush();
+		};
+
+		while (!m_bTelemetryQuit)
+		{
+			WriteQueued();
+			std::this_thread::sleep_for(std::chrono::milliseconds(100));
 		}
+
+		WriteQueued();
+	}
+
+	void StopTelemetryCSV()
+	{
+		if (!m_telemetryThread.joinable())
+			return;
+
+		m_bTelemetryQuit = true;
+		m_telemetryThread.join();
+		m_fileTelemetryCSV.close();
 	}
 
+#ifdef _WIN32
 	static BOOL ControlCloseHandler(DWORD evt)
 	{
 		if (evt == CTRL_CLOSE_EVENT)
@@ -237,17 +2362,83 @@ private:
 		wprintf(L"Error: %s\n\t%s\n", msg, buf);
 		return 0;
 	}
+#else
+	// Signal handlers can't block, so just stop the game thread and let it
+	// restore the terminal on its way out
+	static void ControlCloseHandler(int /*sig*/)
+	{
+		m_bIsRunning = false;
+	}
+
+	int GraphicError(const wchar_t* msg)
+	{
+		int err = errno;
+		RestoreTerminal();
+		wprintf(L"Error: %ls\n\t%s\n", msg, strerror(err));
+		return 0;
+	}
+
+	void WriteTerminal(const char* data, size_t size)
+	{
+		while (size > 0)
+		{
+			ssize_t n = write(STDOUT_FILENO, data, size);
+			if (n < 0)
+			{
+				if (errno == EINTR)
+					continue;
+				return;
+			}
+
+			data += n;
+			size -= n;
+		}
+	}
+
+	void RestoreTerminal()
+	{
+		if (m_bTermActive)
+		{
+			// Turn off mouse and focus reporting, reset colors, enable auto-wrap,
+			// show the cursor and leave the alternate screen
+			const char* seq = "\x1b[?1004l\x1b[?1006l\x1b[?1003l\x1b[0m\x1b[?7h\x1b[?25h\x1b[?1049l";
+			WriteTerminal(seq, strlen(seq));
+			m_bTermActive = false;
+		}
+
+		if (m_bTermModeChanged)
+		{
+			tcsetattr(STDIN_FILENO, TCSAFLUSH, &m_termOriginal);
+			m_bTermModeChanged = false;
+		}
+	}
+
+	void PresentFrameVT(const unsigned char* bufGlyphs, const unsigned char* bufAttributes, const sDirtyRegion& dirty, const char* sTitle)
+	{
+		std::string& out = m_sFrameOut;
+		out.clear();
+		m_vtEncoder.Encode(bufGlyphs, bufAttributes, m_glyphTable, dirty, out);
+
+		// Window title
+		out += "\x1b]0;";
+		out += sTitle;
+		out += '\x07';
+
+		WriteTerminal(out.data(), out.size());
+	}
+#endif
 
 protected:
-	CHAR_INFO* m_bufScreenData;
+	// Screen buffer planes, one byte per cell - glyph indices into the glyph table,
+	// and color attributes with the foreground in the low nibble and background in the high one
+	unsigned char* m_bufGlyphs = nullptr;
+	unsigned char* m_bufAttributes = nullptr;
 
 	struct sKeyState {
 		bool bPressed;
 		bool bReleased;
 		bool bHeld;
 	}m_keys[256], m_mouse[5];
-	bool m_mouseOldState[5] = { 0 };
-	bool m_mouseNewState[5] = { 0 };
 
 	sKeyState GetKey(int nKeyID) const { return m_keys[nKeyID]; }
 	sKeyState GetMouse(int nMouseButtonID) const { return m_mouse[nMouseButtonID]; }
@@ -356,230 +2547,1035 @@ protected:
 		}
 	};
 
+	// Transforms column vectors, (x, y, 1) on the right, so A * B applies B first
 	struct mat3x3 {
 		float m[3][3] = { 0 };
+
+		static mat3x3 Identity()
+		{
+			mat3x3 r;
+			r.m[0][0] = r.m[1][1] = r.m[2][2] = 1.0f;
+			return r;
+		}
+
+		static mat3x3 Translation(float x, float y)
+		{
+			mat3x3 r = Identity();
+			r.m[0][2] = x;
+			r.m[1][2] = y;
+			return r;
+		}
+
+		// Same direction as RotateTriangle, clockwise on screen
+		static mat3x3 Rotation(float fAngle)
+		{
+			float c = cosf(fAngle), s = sinf(fAngle);
+			mat3x3 r = Identity();
+			r.m[0][0] = c; r.m[0][1] = -s;
+			r.m[1][0] = s; r.m[1][1] = c;
+			return r;
+		}
+
+		static mat3x3 Scale(float x, float y)
+		{
+			mat3x3 r = Identity();
+			r.m[0][0] = x;
+			r.m[1][1] = y;
+			return r;
+		}
+
+		mat3x3 operator*(const mat3x3& b) const
+		{
+			mat3x3 r;
+			for (int i = 0; i < 3; i++)
+				for (int j = 0; j < 3; j++)
+					r.m[i][j] = m[i][0] * b.m[0][j] + m[i][1] * b.m[1][j] + m[i][2] * b.m[2][j];
+			return r;
+		}
+
+		// All zeros if the matrix can't be inverted
+		mat3x3 Inverse() const
+		{
+			mat3x3 r;
+			r.m[0][0] = m[1][1] * m[2][2] - m[1][2] * m[2][1];
+			r.m[0][1] = m[0][2] * m[2][1] - m[0][1] * m[2][2];
+			r.m[0][2] = m[0][1] * m[1][2] - m[0][2] * m[1][1];
+			r.m[1][0] = m[1][2] * m[2][0] - m[1][0] * m[2][2];
+			r.m[1][1] = m[0][0] * m[2][2] - m[0][2] * m[2][0];
+			r.m[1][2] = m[0][2] * m[1][0] - m[0][0] * m[1][2];
+			r.m[2][0] = m[1][0] * m[2][1] - m[1][1] * m[2][0];
+			r.m[2][1] = m[0][1] * m[2][0] - m[0][0] * m[2][1];
+			r.m[2][2] = m[0][0] * m[1][1] - m[0][1] * m[1][0];
+
+			float fDet = m[0][0] * r.m[0][0] + m[0][1] * r.m[1][0] + m[0][2] * r.m[2][0];
+			float fInvDet = fDet != 0.0f ? 1.0f / fDet : 0.0f;
+			for (int i = 0; i < 3; i++)
+				for (int j = 0; j < 3; j++)
+					r.m[i][j] *= fInvDet;
+			return r;
+		}
+	};
+
+	// Matrix stack, the top is the current transform. Starts with the identity
+	std::vector<mat3x3> m_vecMatrixStack{ mat3x3::Identity() };
+
+	// How DrawMesh draws its triangles. Back faces are the ones whose corners
+	// wind anticlockwise on screen
+	struct sMeshStyle
+	{
+		COLOR fillColor = FG_WHITE;
+		COLOR edgeColor = FG_WHITE;
+		PIXEL_TYPE pixelType = PIXEL_SOLID;
+		bool bFill = true;
+		bool bEdges = false;
+		bool bCullBackFaces = false;
+	};
+
+	// Draw calls recorded once and drawn with ReplayDrawList as many times as
+	// needed. Commands are drawn by layer, and in the order they were recorded
+	// within a layer. Replaying a list which hasn't changed since it was last
+	// drawn copies the cells it wrote then
+	class DrawList
+	{
+		friend class CrabbyGraphics;
+
+		enum OP : unsigned char { OP_PIXEL, OP_FILL, OP_LINE, OP_FILL_TRIANGLE, OP_FILL_TRIANGLE_EDGE, OP_FILL_CIRCLE, OP_STRING, };
+
+		struct sCommand
+		{
+			OP op;
+			unsigned short nLayer;
+			point_2d p[3];
+			int nValue;			// circle radius, or where a string starts in m_sText
+			int nLength;		// string length
+			COLOR color;
+			COLOR edgeColor;
+			PIXEL_TYPE pixelType;
+		};
+
+		// Cells written by the list, as spans which don't cross rows
+		struct sSpan
+		{
+			int nStart;			// y * width + x
+			int nLength;
+		};
+
+		std::vector<sCommand> m_vecCommands;
+		std::wstring m_sText;
+		unsigned short m_nLayer = 0;
+		std::vector<int> m_vecOrder;		// commands sorted by layer, empty until sorted
+		std::vector<int> m_vecSortScratch;
+
+		bool m_bCached = false;
+		int m_nCacheWidth = 0;
+		int m_nCacheHeight = 0;
+		sClipRect m_cacheClip = {};
+		std::vector<sSpan> m_vecSpans;
+		std::vector<unsigned char> m_vecGlyphs;		// cells of the spans, one after the other
+		std::vector<unsigned char> m_vecAttributes;
+
+		sCommand Command(OP op) const
+		{
+			sCommand cmd = {};
+			cmd.op = op;
+			cmd.nLayer = m_nLayer;
+			cmd.pixelType = PIXEL_SOLID;
+			return cmd;
+		}
+
+		void Record(const sCommand& cmd)
+		{
+			m_vecCommands.push_back(cmd);
+			m_vecOrder.clear();
+			m_bCached = false;
+		}
+
+		// Stable LSD radix sort of the command indices by layer, a byte at a
+		// time. The high byte is skipped when no layer uses it
+		void SortByLayer()
+		{
+			int nCommands = (int)m_vecCommands.size();
+			m_vecOrder.resize(nCommands);
+			m_vecSortScratch.resize(nCommands);
+			unsigned short nMaxLayer = 0;
+			for (int i = 0; i < nCommands; i++)
+			{
+				m_vecOrder[i] = i;
+				nMaxLayer = (std::max)(nMaxLayer, m_vecCommands[i].nLayer);
+			}
+
+			for (int nShift = 0; nShift < 16 && (nMaxLayer >> nShift); nShift += 8)
+			{
+				int nOffset[257] = { 0 };
+				for (int i = 0; i < nCommands; i++)
+					nOffset[((m_vecCommands[i].nLayer >> nShift) & 0xFF) + 1]++;
+				for (int i = 1; i < 257; i++)
+					nOffset[i] += nOffset[i - 1];
+
+				for (int i = 0; i < nCommands; i++)
+				{
+					int nCommand = m_vecOrder[i];
+					m_vecSortScratch[nOffset[(m_vecCommands[nCommand].nLayer >> nShift) & 0xFF]++] = nCommand;
+				}
+				m_vecOrder.swap(m_vecSortScratch);
+			}
+		}
+
+	public:
+		void Clear()
+		{
+			m_vecCommands.clear();
+			m_sText.clear();
+			m_nLayer = 0;
+			m_vecOrder.clear();
+			m_bCached = false;
+		}
+
+		// Layer of the commands recorded from now on, lower layers are drawn first
+		void SetLayer(unsigned short nLayer) { m_nLayer = nLayer; }
+
+		size_t GetCommandCount() const { return m_vecCommands.size(); }
+
+		void Pixelate(const point_2d& p, COLOR color = FG_WHITE, PIXEL_TYPE pixelType = PIXEL_SOLID)
+		{
+			sCommand cmd = Command(OP_PIXEL);
+			cmd.p[0] = p;
+			cmd.color = color;
+			cmd.pixelType = pixelType;
+			Record(cmd);
+		}
+
+		void Fill(const point_2d& p1, const point_2d& p2, COLOR color = FG_WHITE, PIXEL_TYPE pixelType = PIXEL_SOLID)
+		{
+			sCommand cmd = Command(OP_FILL);
+			cmd.p[0] = p1;
+			cmd.p[1] = p2;
+			cmd.color = color;
+			cmd.pixelType = pixelType;
+			Record(cmd);
+		}
+
+		void DrawLine(const point_2d& p1, const point_2d& p2, COLOR color = FG_WHITE, PIXEL_TYPE pixelType = PIXEL_SOLID)
+		{
+			sCommand cmd = Command(OP_LINE);
+			cmd.p[0] = p1;
+			cmd.p[1] = p2;
+			cmd.color = color;
+			cmd.pixelType = pixelType;
+			Record(cmd);
+		}
+
+		void FillTriangle(const point_2d& p1, const point_2d& p2, const point_2d& p3, COLOR fillColor = FG_WHITE, PIXEL_TYPE pixelType = PIXEL_SOLID)
+		{
+			sCommand cmd = Command(OP_FILL_TRIANGLE);
+			cmd.p[0] = p1;
+			cmd.p[1] = p2;
+			cmd.p[2] = p3;
+			cmd.color = fillColor;
+			cmd.pixelType = pixelType;
+			Record(cmd);
+		}
+
+		void FillTriangle(const triangle& t, PIXEL_TYPE pixelType = PIXEL_SOLID)
+		{
+			sCommand cmd = Command(OP_FILL_TRIANGLE_EDGE);
+			cmd.p[0] = t.p[0];
+			cmd.p[1] = t.p[1];
+			cmd.p[2] = t.p[2];
+			cmd.color = t.fillColor;
+			cmd.edgeColor = t.edgeColor;
+			cmd.pixelType = pixelType;
+			Record(cmd);
+		}
+
+		void FillCircle(const point_2d& center, int radius, COLOR color = FG_WHITE, PIXEL_TYPE pixelType = PIXEL_SOLID)
+		{
+			sCommand cmd = Command(OP_FILL_CIRCLE);
+			cmd.p[0] = center;
+			cmd.nValue = radius;
+			cmd.color = color;
+			cmd.pixelType = pixelType;
+			Record(cmd);
+		}
+
+		void DrawString(int x, int y, const std::wstring& str, COLOR color = FG_WHITE)
+		{
+			sCommand cmd = Command(OP_STRING);
+			cmd.p[0] = { x, y };
+			cmd.nValue = (int)m_sText.size();
+			cmd.nLength = (int)str.size();
+			cmd.color = color;
+			m_sText += str;
+			Record(cmd);
+		}
 	};
 
-	int ScreenWidth() const { return m_screenWidth; }
-	int ScreenHeight() const { return m_screenHeight; }
-	int GetMousePosX() const { return m_mousePosX; }
-	int GetMousePosY() const { return m_mousePosY; }
+	int ScreenWidth() const { return m_screenWidth; }
+	int ScreenHeight() const { return m_screenHeight; }
+	int GetMousePosX() const { return m_mousePosX; }
+	int GetMousePosY() const { return m_mousePosY; }
+
+	// Matrix functions
+	void MultiplyMatrix3x3(const vec_2d<>& i, vec_2d<>& o, const mat3x3& m)
+	{
+		o.x = roundf(m.m[0][0] * i.x + m.m[0][1] * i.y + m.m[0][2] * 1.0f);
+		o.y = roundf(m.m[1][0] * i.x + m.m[1][1] * i.y + m.m[1][2] * 1.0f);
+		float w = m.m[2][0] * i.x + m.m[2][1] * i.y + m.m[2][2] * 1.0f;
+	}
+
+	// Transforms nPoints points in one pass, in may be the same array as out.
+	// Points stay in floats, round them to cells only when drawing so moving
+	// something a little every frame doesn't drift
+	void TransformPoints(const vec_2d<float>* in, vec_2d<float>* out, int nPoints, const mat3x3& m)
+	{
+		float a = m.m[0][0], b = m.m[0][1], c = m.m[0][2];
+		float d = m.m[1][0], e = m.m[1][1], f = m.m[1][2];
+		for (int i = 0; i < nPoints; i++)
+		{
+			float x = in[i].x, y = in[i].y;
+			out[i].x = a * x + b * y + c;
+			out[i].y = d * x + e * y + f;
+		}
+	}
+
+	void TransformPoints(const vec_2d<float>* in, vec_2d<float>* out, int nPoints)
+	{
+		TransformPoints(in, out, nPoints, m_vecMatrixStack.back());
+	}
+
+	// Nearest cell to a point
+	point_2d SnapPoint(const vec_2d<float>& p) const
+	{
+		return point_2d((int)roundf(p.x), (int)roundf(p.y));
+	}
+
+	// Saves the current transform, PopMatrix goes back to it
+	void PushMatrix() { m_vecMatrixStack.push_back(m_vecMatrixStack.back()); }
+
+	void PopMatrix()
+	{
+		if (m_vecMatrixStack.size() > 1)
+			m_vecMatrixStack.pop_back();
+	}
+
+	const mat3x3& GetMatrix() const { return m_vecMatrixStack.back(); }
+	void SetMatrix(const mat3x3& m) { m_vecMatrixStack.back() = m; }
+
+	// Applies m before the current transform, so the last one applied acts first
+	void ApplyMatrix(const mat3x3& m) { m_vecMatrixStack.back() = m_vecMatrixStack.back() * m; }
+	void Translate(float x, float y) { ApplyMatrix(mat3x3::Translation(x, y)); }
+	void Rotate(float fAngle) { ApplyMatrix(mat3x3::Rotation(fAngle)); }
+	void Scale(float x, float y) { ApplyMatrix(mat3x3::Scale(x, y)); }
+
+	// Draw functions
+	// Clears the clip rectangle, the whole screen unless PushClip has set one
+	void ClearScreen()
+	{
+		if (!(m_clip == sClipRect{ 0, 0, m_screenWidth - 1, m_screenHeight - 1 }))
+		{
+			Fill({ m_clip.x1, m_clip.y1 }, { m_clip.x2 + 1, m_clip.y2 + 1 }, FG_BLACK, PIXEL_SOLID);
+			return;
+		}
+
+		// Anything still binned would be drawn over
+		if (!m_vecTileCommands.empty())
+		{
+			for (std::vector<int>& bin : m_vecTileBins)
+				bin.clear();
+			m_vecTileCommands.clear();
+		}
+
+		std::fill_n(m_bufGlyphs, m_screenWidth * m_screenHeight, (unsigned char)GlyphTable::GLYPH_SOLID);
+		std::fill_n(m_bufAttributes, m_screenWidth * m_screenHeight, (unsigned char)FG_BLACK);
+		MarkAllDirty();
+	}
+
+	// Records that columns x1..x2 of row y have been written this frame.
+	// Expects on-screen coordinates
+	void MarkDirty(int x1, int x2, int y)
+	{
+		m_dirty->Mark(x1, x2, y);
+	}
+
+	// Call this after writing into m_bufGlyphs/m_bufAttributes directly
+	void MarkDirty(const point_2d& p1, const point_2d& p2)
+	{
+		int x1 = (std::max)(p1.x, 0), x2 = (std::min)(p2.x, m_screenWidth - 1);
+		int y1 = (std::max)(p1.y, 0), y2 = (std::min)(p2.y, m_screenHeight - 1);
+
+		if (x1 > x2)
+			return;
+
+		for (int y = y1; y <= y2; y++)
+			MarkDirty(x1, x2, y);
+	}
+
+	void MarkAllDirty()
+	{
+		MarkDirty({ 0, 0 }, { m_screenWidth - 1, m_screenHeight - 1 });
+	}
+
+	// Restricts drawing to the rectangle from p1 up to p2, not including p2, inside
+	// whatever clip is already set. PopClip goes back to the previous one
+	void PushClip(const point_2d& p1, const point_2d& p2)
+	{
+		m_vecClipStack.push_back(m_clip);
+		m_clip.x1 = (std::max)(m_clip.x1, p1.x);
+		m_clip.y1 = (std::max)(m_clip.y1, p1.y);
+		m_clip.x2 = (std::min)(m_clip.x2, p2.x - 1);
+		m_clip.y2 = (std::min)(m_clip.y2, p2.y - 1);
+	}
 
-	// Matrix functions
-	void MultiplyMatrix3x3(const vec_2d<>& i, vec_2d<>& o, const mat3x3& m)
+	void PopClip()
 	{
-		o.x = roundf(m.m[0][0] * i.x + m.m[0][1] * i.y + m.m[0][2] * 1.0f);
-		o.y = roundf(m.m[1][0] * i.x + m.m[1][1] * i.y + m.m[1][2] * 1.0f);
-		float w = m.m[2][0] * i.x + m.m[2][1] * i.y + m.m[2][2] * 1.0f;
+		if (m_vecClipStack.empty())
+			return;
+
+		m_clip = m_vecClipStack.back();
+		m_vecClipStack.pop_back();
 	}
 
-	// Draw functions
-	void ClearScreen()
+	// Rasterizes everything binned by tiled rendering. Whatever isn't binned
+	// flushes first so cells are written in the order they were drawn, call it
+	// before reading m_bufGlyphs/m_bufAttributes directly with tiled rendering on
+	void FlushTiles()
 	{
-		Fill({ 0, 0 }, { m_screenWidth, m_screenHeight }, FG_BLACK, PIXEL_SOLID);
+		if (m_vecTileCommands.empty())
+			return;
+
+		m_tileWorkers.Run(m_nTilesX * m_nTilesY, [this](int nTile)
+		{
+			int tx = nTile % m_nTilesX, ty = nTile / m_nTilesX;
+			int x1 = tx * TILE_WIDTH, x2 = (std::min)(x1 + TILE_WIDTH, m_screenWidth) - 1;
+			int y1 = ty * TILE_HEIGHT, y2 = (std::min)(y1 + TILE_HEIGHT, m_screenHeight) - 1;
+
+			std::vector<int>& bin = m_vecTileBins[nTile];
+			for (int nCommand : bin)
+				RasterizeCommand(m_vecTileCommands[nCommand], x1, y1, x2, y2);
+			bin.clear();
+		});
+
+		m_vecTileCommands.clear();
 	}
 
+	// Index of a glyph in the glyph table, for writing into m_bufGlyphs directly
+	unsigned char GlyphIndex(wchar_t glyph) { return m_glyphTable.Index(glyph); }
+
 	void Pixelate(const point_2d& p, COLOR color = FG_WHITE, PIXEL_TYPE pixelType = PIXEL_SOLID)
 	{
-		if (p.x >= 0 && p.x < m_screenWidth && p.y >= 0 && p.y < m_screenHeight)
+		if (!m_vecTileCommands.empty())
+			FlushTiles();
+
+		PlotPixel(p, color, pixelType);
+	}
+
+	// Pixelate for primitives which flush the tiles once before drawing,
+	// keeping the check out of their inner loops
+	void PlotPixel(const point_2d& p, COLOR color, PIXEL_TYPE pixelType)
+	{
+		if (p.x >= m_clip.x1 && p.x <= m_clip.x2 && p.y >= m_clip.y1 && p.y <= m_clip.y2)
 		{
-			m_bufScreenData[p.y * m_screenWidth + p.x].Char.UnicodeChar = pixelType;
-			m_bufScreenData[p.y * m_screenWidth + p.x].Attributes = color;
+			m_bufGlyphs[p.y * m_screenWidth + p.x] = m_glyphTable.Index(pixelType);
+			m_bufAttributes[p.y * m_screenWidth + p.x] = (unsigned char)color;
+			MarkDirty(p.x, p.x, p.y);
 		}
 	}
 
+	// Fills p1 up to but not including p2. Each row of the rectangle is one span
+	// in both planes, see RasterizeCommand
 	void Fill(const point_2d& p1, const point_2d& p2, COLOR color = FG_WHITE, PIXEL_TYPE pixelType = PIXEL_SOLID)
 	{
-		for (int x = p1.x; x < p2.x; x++)
-			for (int y = p1.y; y < p2.y; y++)
-				Pixelate({ x, y }, color, pixelType);
+		sDrawCommand cmd = {};
+		cmd.type = DRAW_FILL;
+		cmd.x1 = p1.x;
+		cmd.y1 = p1.y;
+		cmd.x2 = p2.x - 1;
+		cmd.y2 = p2.y - 1;
+		cmd.nGlyph = m_glyphTable.Index(pixelType);
+		cmd.nAttributes = (unsigned char)color;
+		DrawCommand(cmd);
 	}
 
 	void DrawTriangle(const point_2d& p1, const point_2d& p2, const point_2d& p3, COLOR color = FG_WHITE, PIXEL_TYPE pixelType = PIXEL_SOLID)
 	{
-		DrawLine(p1, p2);
-		DrawLine(p2, p3);
-		DrawLine(p3, p1);
+		DrawLine(p1, p2, color, pixelType);
+		DrawLine(p2, p3, color, pixelType);
+		DrawLine(p3, p1, color, pixelType);
 	}
 
 	void DrawTriangle(const triangle& t, PIXEL_TYPE pixelType = PIXEL_SOLID)
 	{
-		DrawTriangle(t.p[0], t.p[1], t.p[2]);
+		DrawTriangle(t.p[0], t.p[1], t.p[2], t.edgeColor, pixelType);
 	}
 
+	// Fills the inside of the triangle, see RasterizeCommand. What is already
+	// on the screen doesn't matter, so fills can be binned and reordered
 	void FillTriangle(const point_2d& p1, const point_2d& p2, const point_2d& p3, COLOR fillColor = FG_WHITE, PIXEL_TYPE pixelType = PIXEL_SOLID)
 	{
-		// TODO: Use threads maybe?
-		// 
 		// Calculate bounding box
-		int x_min = min(min(p1.x, p2.x), p3.x);
-		int y_min = min(min(p1.y, p2.y), p3.y);
-		int x_max = max(max(p1.x, p3.x), p3.x);
-		int y_max = max(max(p1.y, p2.y), p3.y);
+		sDrawCommand cmd = {};
+		cmd.type = DRAW_FILL_TRIANGLE;
+		cmd.x1 = (std::min)((std::min)(p1.x, p2.x), p3.x);
+		cmd.y1 = (std::min)((std::min)(p1.y, p2.y), p3.y);
+		cmd.x2 = (std::max)((std::max)(p1.x, p2.x), p3.x);
+		cmd.y2 = (std::max)((std::max)(p1.y, p2.y), p3.y);
+		cmd.px[0] = p1.x; cmd.py[0] = p1.y;
+		cmd.px[1] = p2.x; cmd.py[1] = p2.y;
+		cmd.px[2] = p3.x; cmd.py[2] = p3.y;
+		cmd.nGlyph = m_glyphTable.Index(pixelType);
+		cmd.nAttributes = (unsigned char)fillColor;
+		DrawCommand(cmd);
+	}
 
-		for (int y = y_min; y <= y_max; y++)
+	// Fills the triangle with its fill color and draws its edges over it in its
+	// edge color, as one primitive
+	void FillTriangle(const triangle& t, PIXEL_TYPE pixelType = PIXEL_SOLID)
+	{
+		// Calculate bounding box
+		sDrawCommand cmd = {};
+		cmd.type = DRAW_FILL_TRIANGLE;
+		cmd.x1 = (std::min)((std::min)(t.p[0].x, t.p[1].x), t.p[2].x);
+		cmd.y1 = (std::min)((std::min)(t.p[0].y, t.p[1].y), t.p[2].y);
+		cmd.x2 = (std::max)((std::max)(t.p[0].x, t.p[1].x), t.p[2].x);
+		cmd.y2 = (std::max)((std::max)(t.p[0].y, t.p[1].y), t.p[2].y);
+		for (int i = 0; i < 3; i++)
 		{
-			for (int x = x_min; x <= x_max; x++)
-			{
-				if (IsPointInsideTriangle({ x, y }, p1, p2, p3) && !(m_bufScreenData[y * m_screenWidth + x].Attributes == FG_WHITE))
-				{
-					Pixelate({ x, y }, fillColor, PIXEL_SOLID);
-				}
-			}
+			cmd.px[i] = t.p[i].x;
+			cmd.py[i] = t.p[i].y;
 		}
+		cmd.nGlyph = m_glyphTable.Index(pixelType);
+		cmd.nAttributes = (unsigned char)t.fillColor;
+		cmd.nEdgeAttributes = (unsigned char)t.edgeColor;
+		cmd.bOutline = true;
+		DrawCommand(cmd);
 	}
 
-	void FillTriangle(const triangle& t, PIXEL_TYPE pixelType = PIXEL_SOLID)
+	// Draws an indexed triangle mesh, every three indices into vertices making a
+	// triangle. Each vertex is transformed once however many triangles share it,
+	// then triangles entirely off one side of the clip rectangle, or facing away when
+	// culling, are dropped before they're rasterized. A filled and edged triangle
+	// is a single command, like FillTriangle(const triangle&)
+	void DrawMesh(const std::vector<vec_2d<float>>& vertices, const std::vector<int>& indices, const mat3x3& transform, const sMeshStyle& style)
 	{
-		// Calculate bounding box
-		int x_min = min(min(t.p[0].x, t.p[1].x), t.p[2].x);
-		int y_min = min(min(t.p[0].y, t.p[1].y), t.p[2].y);
-		int x_max = max(max(t.p[0].x, t.p[1].x), t.p[2].x);
-		int y_max = max(max(t.p[0].y, t.p[1].y), t.p[2].y);
+		if (!style.bFill && !style.bEdges)
+			return;
+
+		enum { OFF_LEFT = 1, OFF_RIGHT = 2, OFF_TOP = 4, OFF_BOTTOM = 8 };
+
+		// Transformed in separate passes over plain arrays so the loops vectorize
+		int nVertices = (int)vertices.size();
+		m_vecMeshX.resize(nVertices);
+		m_vecMeshY.resize(nVertices);
+		m_vecMeshOutcodes.resize(nVertices);
+		int* vx = m_vecMeshX.data();
+		int* vy = m_vecMeshY.data();
+		unsigned char* outcodes = m_vecMeshOutcodes.data();
+		const float* m0 = transform.m[0];
+		const float* m1 = transform.m[1];
+		for (int i = 0; i < nVertices; i++)
+		{
+			vx[i] = (int)roundf(m0[0] * vertices[i].x + m0[1] * vertices[i].y + m0[2]);
+			vy[i] = (int)roundf(m1[0] * vertices[i].x + m1[1] * vertices[i].y + m1[2]);
+		}
+		for (int i = 0; i < nVertices; i++)
+			outcodes[i] = (vx[i] < m_clip.x1 ? OFF_LEFT : 0) | (vx[i] > m_clip.x2 ? OFF_RIGHT : 0) | (vy[i] < m_clip.y1 ? OFF_TOP : 0) | (vy[i] > m_clip.y2 ? OFF_BOTTOM : 0);
+
+		sDrawCommand cmd = {};
+		cmd.type = style.bFill ? DRAW_FILL_TRIANGLE : DRAW_TRIANGLE_EDGES;
+		cmd.nGlyph = m_glyphTable.Index(style.pixelType);
+		cmd.nAttributes = (unsigned char)style.fillColor;
+		cmd.nEdgeAttributes = (unsigned char)style.edgeColor;
+		cmd.bOutline = style.bFill && style.bEdges;
 
-		for (int y = y_min; y <= y_max; y++)
+		for (size_t i = 0; i + 2 < indices.size(); i += 3)
 		{
-			for (int x = x_min; x <= x_max; x++)
+			int i0 = indices[i], i1 = indices[i + 1], i2 = indices[i + 2];
+			if (outcodes[i0] & outcodes[i1] & outcodes[i2])
+				continue;
+
+			if (style.bCullBackFaces)
 			{
-				if (x >= 0 && x < m_screenWidth && y >= 0 && y < m_screenHeight)
-				{
-					if (IsPointInsideTriangle({ x, y }, t.p[0], t.p[1], t.p[2]) && !(m_bufScreenData[y * m_screenWidth + x].Attributes == t.edgeColor))
-					{
-						Pixelate({ x, y }, t.fillColor, pixelType);
-					}
-				}
+				long long nArea = (long long)(vx[i1] - vx[i0]) * (vy[i2] - vy[i0]) - (long long)(vy[i1] - vy[i0]) * (vx[i2] - vx[i0]);
+				if (nArea <= 0)
+					continue;
 			}
+
+			cmd.px[0] = vx[i0]; cmd.py[0] = vy[i0];
+			cmd.px[1] = vx[i1]; cmd.py[1] = vy[i1];
+			cmd.px[2] = vx[i2]; cmd.py[2] = vy[i2];
+			cmd.x1 = (std::min)((std::min)(cmd.px[0], cmd.px[1]), cmd.px[2]);
+			cmd.y1 = (std::min)((std::min)(cmd.py[0], cmd.py[1]), cmd.py[2]);
+			cmd.x2 = (std::max)((std::max)(cmd.px[0], cmd.px[1]), cmd.px[2]);
+			cmd.y2 = (std::max)((std::max)(cmd.py[0], cmd.py[1]), cmd.py[2]);
+			DrawCommand(cmd);
 		}
 	}
 
-	void DrawLine(const point_2d& p1, const point_2d& p2, COLOR color = FG_WHITE, PIXEL_TYPE pixelType = PIXEL_SOLID)
+	// Calls plot(x, y) for every cell of the line from p1 to p2 inside the clip
+	// rectangle (inclusive), so plot needn't check. The line is clipped before it's
+	// stepped: Bresenham starts at the first step inside with the error term it
+	// would have had there, so the cells are the ones the whole line would draw
+	template <typename F>
+	void TraceLine(const point_2d& p1, const point_2d& p2, int cx1, int cy1, int cx2, int cy2, F plot)
 	{
-		//if(p1.x >= 0 && p2.x >= 0 && p1.x < m_screenWidth && p2.x < m_screenWidth && p1.y >= 0 && p2.y >= 0 && p1.y < m_screenHeight && p2.y < m_screenHeight)
 		int dx = p2.x - p1.x;
 		int dy = p2.y - p1.y;
 
 		int mod_dx = std::abs(dx);
 		int mod_dy = std::abs(dy);
 
-		int px = 2 * mod_dy - mod_dx;
-		int py = 2 * mod_dx - mod_dy;
+		// Step along the major axis u from the end with the smaller u, the minor
+		// axis v moving by nStepV whenever the error term says so. Lines mostly
+		// along x step v when the error is >= 0, lines along y when it's > 0
+		bool bAlongX = mod_dy <= mod_dx;
+		const point_2d& start = (bAlongX ? dx >= 0 : dy >= 0) ? p1 : p2;
+		int u0 = bAlongX ? start.x : start.y, v0 = bAlongX ? start.y : start.x;
+		int ulo = bAlongX ? cx1 : cy1, uhi = bAlongX ? cx2 : cy2;
+		int vlo = bAlongX ? cy1 : cx1, vhi = bAlongX ? cy2 : cx2;
+		long long M = bAlongX ? mod_dx : mod_dy, m = bAlongX ? mod_dy : mod_dx;
+		int nBias = bAlongX ? 0 : 1;
+		int nStepV = (dx < 0 && dy < 0) || (dx > 0 && dy > 0) ? 1 : -1;
+
+		auto FloorDiv = [](long long n, long long d) { return n >= 0 ? n / d : -((-n + d - 1) / d); };
+
+		// v has moved k(i) = floor((2mi + M - bias) / 2M) times after i steps.
+		// Keep the steps where u and v are both inside
+		long long i0 = (std::max)(0LL, (long long)ulo - u0), i1 = (std::min)(M, (long long)uhi - u0);
+		long long kmin = nStepV > 0 ? vlo - v0 : v0 - vhi, kmax = nStepV > 0 ? vhi - v0 : v0 - vlo;
+		if (m == 0)
+		{
+			if (kmin > 0 || kmax < 0)
+				return;
+		}
+		else
+		{
+			i0 = (std::max)(i0, -FloorDiv(-(2 * M * kmin - M + nBias), 2 * m));
+			i1 = (std::min)(i1, FloorDiv(2 * M * (kmax + 1) - M + nBias - 1, 2 * m));
+		}
+		if (i0 > i1)
+			return;
 
-		int x, y, large_x, large_y;
+		long long k = M == 0 ? 0 : FloorDiv(2 * m * i0 + M - nBias, 2 * M);
+		long long e = 2 * m - M + 2 * m * i0 - 2 * M * k;
+		int u = u0 + (int)i0, v = v0 + nStepV * (int)k;
+		int nSteps = (int)(i1 - i0);
 
-		if (mod_dy <= mod_dx)
+		if (bAlongX)
 		{
-			if (dx >= 0)
+			plot(u, v);
+			for (int i = 0; i < nSteps; i++)
 			{
-				x = p1.x; y = p1.y; large_x = p2.x;
+				u++;
+				if (e < 0)
+					e += 2 * m;
+				else
+				{
+					v += nStepV;
+					e += 2 * (m - M);
+				}
+				plot(u, v);
 			}
-			else
+		}
+		else
+		{
+			plot(v, u);
+			for (int i = 0; i < nSteps; i++)
 			{
-				x = p2.x; y = p2.y; large_x = p1.x;
+				u++;
+				if (e <= 0)
+					e += 2 * m;
+				else
+				{
+					v += nStepV;
+					e += 2 * (m - M);
+				}
+				plot(v, u);
 			}
+		}
+	}
+
+	void DrawLine(const point_2d& p1, const point_2d& p2, COLOR color = FG_WHITE, PIXEL_TYPE pixelType = PIXEL_SOLID)
+	{
+		if (!m_vecTileCommands.empty())
+			FlushTiles();
 
-			Pixelate({ x, y }, color, pixelType);
+		PlotLine(p1, p2, m_glyphTable.Index(pixelType), (unsigned char)color);
+	}
 
-			for (int i = 0; x < large_x; i++)
-			{
-				x++;
-				if (px < 0)
-					px = px + 2 * mod_dy;
-				else
-				{
-					if ((dx < 0 && dy < 0) || (dx > 0 && dy > 0))
-						y++;
-					else
-						y--;
+	// Draws a line through each point in turn, and back to the first if bClosed
+	void DrawPolyline(const point_2d* points, int nPoints, COLOR color = FG_WHITE, PIXEL_TYPE pixelType = PIXEL_SOLID, bool bClosed = false)
+	{
+		if (nPoints < 2)
+			return;
 
-					px = px + 2 * (mod_dy - mod_dx);
-				}
+		DrawLineBatch(points, nPoints - 1, 1, color, pixelType);
+		if (bClosed)
+		{
+			point_2d pClose[2] = { points[nPoints - 1], points[0] };
+			DrawLineBatch(pClose, 1, 1, color, pixelType);
+		}
+	}
+
+	// Draws a line between each pair of points, points[0] to points[1], points[2]
+	// to points[3] and so on
+	void DrawLines(const point_2d* points, int nPoints, COLOR color = FG_WHITE, PIXEL_TYPE pixelType = PIXEL_SOLID)
+	{
+		DrawLineBatch(points, nPoints / 2, 2, color, pixelType);
+	}
+
+	// Draws the lines from points[i * nStride] to the point after it. Lines wholly
+	// off one side of the clip rectangle are dropped before anything else is worked out.
+	// With tiled rendering on they're binned like fills, so a long batch is split
+	// across the workers by screen region
+	void DrawLineBatch(const point_2d* points, int nLines, int nStride, COLOR color, PIXEL_TYPE pixelType)
+	{
+		enum { OFF_LEFT = 1, OFF_RIGHT = 2, OFF_TOP = 4, OFF_BOTTOM = 8 };
+		auto Outcode = [&](const point_2d& p)
+		{
+			return (p.x < m_clip.x1 ? OFF_LEFT : 0) | (p.x > m_clip.x2 ? OFF_RIGHT : 0) | (p.y < m_clip.y1 ? OFF_TOP : 0) | (p.y > m_clip.y2 ? OFF_BOTTOM : 0);
+		};
+
+		unsigned char nGlyph = m_glyphTable.Index(pixelType);
+		unsigned char nAttributes = (unsigned char)color;
+
+		if (!m_bTiled)
+		{
+			if (!m_vecTileCommands.empty())
+				FlushTiles();
 
-				Pixelate({ x, y }, color, pixelType);
+			for (int i = 0; i < nLines; i++)
+			{
+				const point_2d& p1 = points[i * nStride];
+				const point_2d& p2 = points[i * nStride + 1];
+				if (!(Outcode(p1) & Outcode(p2)))
+					PlotLine(p1, p2, nGlyph, nAttributes);
 			}
+			return;
 		}
-		else
+
+		sDrawCommand cmd = {};
+		cmd.type = DRAW_LINE;
+		cmd.nGlyph = nGlyph;
+		cmd.nAttributes = nAttributes;
+		for (int i = 0; i < nLines; i++)
 		{
-			if (dy >= 0)
+			const point_2d& p1 = points[i * nStride];
+			const point_2d& p2 = points[i * nStride + 1];
+			if (Outcode(p1) & Outcode(p2))
+				continue;
+
+			cmd.px[0] = p1.x; cmd.py[0] = p1.y;
+			cmd.px[1] = p2.x; cmd.py[1] = p2.y;
+			cmd.x1 = (std::min)(p1.x, p2.x);
+			cmd.y1 = (std::min)(p1.y, p2.y);
+			cmd.x2 = (std::max)(p1.x, p2.x);
+			cmd.y2 = (std::max)(p1.y, p2.y);
+			DrawCommand(cmd);
+		}
+	}
+
+	// DrawLine without flushing tiled rendering first
+	void PlotLine(const point_2d& p1, const point_2d& p2, unsigned char nGlyph, unsigned char nAttributes)
+	{
+		// Horizontal and vertical lines are clipped and stored as a span or a column
+		if (p1.y == p2.y || p1.x == p2.x)
+		{
+			int x1 = (std::max)((std::min)(p1.x, p2.x), m_clip.x1), x2 = (std::min)((std::max)(p1.x, p2.x), m_clip.x2);
+			int y1 = (std::max)((std::min)(p1.y, p2.y), m_clip.y1), y2 = (std::min)((std::max)(p1.y, p2.y), m_clip.y2);
+			if (x1 > x2 || y1 > y2)
+				return;
+
+			if (y1 == y2)
 			{
-				x = p1.x; y = p1.y; large_y = p2.y;
+				std::fill_n(m_bufGlyphs + y1 * m_screenWidth + x1, x2 - x1 + 1, nGlyph);
+				std::fill_n(m_bufAttributes + y1 * m_screenWidth + x1, x2 - x1 + 1, nAttributes);
 			}
 			else
 			{
-				x = p2.x; y = p2.y; large_y = p1.y;
+				for (int y = y1; y <= y2; y++)
+				{
+					m_bufGlyphs[y * m_screenWidth + x1] = nGlyph;
+					m_bufAttributes[y * m_screenWidth + x1] = nAttributes;
+				}
 			}
+			MarkDirty({ x1, y1 }, { x2, y2 });
+			return;
+		}
+
+		TraceLine(p1, p2, m_clip.x1, m_clip.y1, m_clip.x2, m_clip.y2, [&](int x, int y)
+		{
+			m_bufGlyphs[y * m_screenWidth + x] = nGlyph;
+			m_bufAttributes[y * m_screenWidth + x] = nAttributes;
+			MarkDirty(x, x, y);
+		});
+	}
+
+	void DrawCircle(const point_2d& center, int radius, COLOR color = FG_WHITE, PIXEL_TYPE pixelType = PIXEL_SOLID)
+	{
+		if (radius > 0)
+			DrawShape(center, radius, radius, false, color, pixelType);
+	}
+
+	void FillCircle(const point_2d& center, int radius, COLOR color = FG_WHITE, PIXEL_TYPE pixelType = PIXEL_SOLID)
+	{
+		if (radius > 0)
+			DrawShape(center, radius, radius, true, color, pixelType);
+	}
+
+	void DrawEllipse(const point_2d& center, int radiusX, int radiusY, COLOR color = FG_WHITE, PIXEL_TYPE pixelType = PIXEL_SOLID)
+	{
+		if (radiusX >= 0 && radiusY >= 0 && radiusX + radiusY > 0)
+			DrawShape(center, radiusX, radiusY, false, color, pixelType);
+	}
+
+	void FillEllipse(const point_2d& center, int radiusX, int radiusY, COLOR color = FG_WHITE, PIXEL_TYPE pixelType = PIXEL_SOLID)
+	{
+		if (radiusX >= 0 && radiusY >= 0 && radiusX + radiusY > 0)
+			DrawShape(center, radiusX, radiusY, true, color, pixelType);
+	}
+
+	// Draws a circle or ellipse from its span table, one span store per run of
+	// cells. With tiled rendering on it's binned like any other fill
+	void DrawShape(const point_2d& center, int rx, int ry, bool bFill, COLOR color, PIXEL_TYPE pixelType)
+	{
+		const std::vector<sShapeSpan>& vecSpans = ShapeSpans(rx, ry, bFill);
+
+		sDrawCommand cmd = {};
+		cmd.type = DRAW_SPANS;
+		cmd.x1 = center.x - rx;
+		cmd.y1 = center.y - ry;
+		cmd.x2 = center.x + rx;
+		cmd.y2 = center.y + ry;
+		cmd.px[0] = center.x;
+		cmd.py[0] = center.y;
+		cmd.pSpans = vecSpans.data();
+		cmd.nSpans = (int)vecSpans.size();
+		cmd.nGlyph = m_glyphTable.Index(pixelType);
+		cmd.nAttributes = (unsigned char)color;
+		DrawCommand(cmd);
+	}
+
+	// The span table of a circle (rx == ry) or ellipse, worked out the first time
+	// those radii are drawn. Circles use the midpoint circle algorithm, ellipses
+	// the midpoint ellipse one, filled shapes cover each row between its outline
+	const std::vector<sShapeSpan>& ShapeSpans(int rx, int ry, bool bFill)
+	{
+		sRasterKey key = { RASTER_ELLIPSE, { rx, ry, bFill ? 1 : 0, 0, 0 } };
+		if (const std::vector<sShapeSpan>* pSpans = m_rasterCache.Find(key))
+			return *pSpans;
+
+		if (m_vecTileCommands.empty())
+			m_rasterCache.Trim();
 
-			Pixelate({ x, y }, color, pixelType);
+		// Outline cells, as (dy, dx) pairs
+		std::vector<std::pair<int, int>> vecCells;
+		auto Plot4 = [&](int x, int y)
+		{
+			vecCells.push_back({ -y, -x });
+			vecCells.push_back({ -y, x });
+			vecCells.push_back({ y, -x });
+			vecCells.push_back({ y, x });
+		};
 
-			for (int i = 0; y < large_y; i++)
+		if (rx == ry)
+		{
+			int x = 0;
+			int y = rx;
+			int p = 3 - 2 * rx;
+			while (y >= x)
+			{
+				Plot4(x, y);
+				Plot4(y, x);
+				if (p < 0) p += 4 * x++ + 6;
+				else p += 4 * (x++ - y--) + 10;
+			}
+		}
+		else if (rx == 0 || ry == 0)
+		{
+			for (int x = 0; x <= rx; x++)
+				Plot4(x, 0);
+			for (int y = 0; y <= ry; y++)
+				Plot4(0, y);
+		}
+		else
+		{
+			// Decisions are scaled by 4 to stay in integers
+			long long rx2 = (long long)rx * rx, ry2 = (long long)ry * ry;
+			long long x = 0, y = ry;
+			long long p = 4 * ry2 - 4 * rx2 * ry + rx2;
+			while (ry2 * x < rx2 * y)
 			{
-				y = y + 1;
-				if (py <= 0)
-					py = py + 2 * mod_dx;
+				Plot4((int)x, (int)y);
+				x++;
+				if (p < 0)
+					p += 4 * (2 * ry2 * x + ry2);
 				else
 				{
-					if ((dx < 0 && dy < 0) || (dx > 0 && dy > 0)) x = x + 1; else x = x - 1;
-					py = py + 2 * (mod_dx - mod_dy);
+					y--;
+					p += 4 * (2 * ry2 * x - 2 * rx2 * y + ry2);
 				}
+			}
 
-				Pixelate({ x, y }, color, pixelType);
+			p = ry2 * (2 * x + 1) * (2 * x + 1) + 4 * rx2 * (y - 1) * (y - 1) - 4 * rx2 * ry2;
+			while (y >= 0)
+			{
+				Plot4((int)x, (int)y);
+				y--;
+				if (p > 0)
+					p += 4 * (rx2 - 2 * rx2 * y);
+				else
+				{
+					x++;
+					p += 4 * (2 * ry2 * x - 2 * rx2 * y + rx2);
+				}
 			}
 		}
+
+		std::vector<sShapeSpan>& vecSpans = m_rasterCache.Insert(key);
+		AppendSpans(vecCells, bFill, false, vecSpans);
+		return vecSpans;
 	}
 
-	void DrawCircle(const point_2d& center, int radius, COLOR color = FG_WHITE, PIXEL_TYPE pixelType = PIXEL_SOLID)
+	// Appends (dy, dx) cells to a span table as runs, or as one span per row from
+	// its first cell to its last when bFill
+	void AppendSpans(std::vector<std::pair<int, int>>& vecCells, bool bFill, bool bEdge, std::vector<sShapeSpan>& vecSpans)
 	{
-		// Using Midpoint circle algorithm
-		int x = 0;
-		int y = radius;
-		int p = 3 - 2 * radius;
-		if (!radius) return;
+		std::sort(vecCells.begin(), vecCells.end());
+		vecCells.erase(std::unique(vecCells.begin(), vecCells.end()), vecCells.end());
 
-		while (y >= x)
+		size_t nFirst = vecSpans.size();
+		for (size_t i = 0; i < vecCells.size(); i++)
 		{
-			Pixelate({ center.x - x, center.y - y }, color, pixelType);		//upper left left
-			Pixelate({ center.x - y, center.y - x }, color, pixelType);		//upper upper left
-			Pixelate({ center.x + y, center.y - x }, color, pixelType);		//upper upper right
-			Pixelate({ center.x + x, center.y - y }, color, pixelType);		//upper right right
-			Pixelate({ center.x - x, center.y + y }, color, pixelType);		//lower left left
-			Pixelate({ center.x - y, center.y + x }, color, pixelType);		//lower lower left
-			Pixelate({ center.x + y, center.y + x }, color, pixelType);		//lower lower right
-			Pixelate({ center.x + x, center.y + y }, color, pixelType);		//lower right right
+			int dy = vecCells[i].first, dx = vecCells[i].second;
+			bool bJoins = vecSpans.size() > nFirst && vecSpans.back().dy == dy && (bFill || vecSpans.back().x2 + 1 == dx);
+			if (bJoins)
+				vecSpans.back().x2 = dx;
+			else
+				vecSpans.push_back({ dy, dx, dx, bEdge });
+		}
+	}
+
+	// Only the part of the string inside the clip rectangle is drawn
+	void DrawString(int x, int y, std::wstring str, COLOR color = FG_WHITE)
+	{
+		int x1 = (std::max)(x, m_clip.x1), x2 = (std::min)(x + (int)str.size() - 1, m_clip.x2);
+		if (y < m_clip.y1 || y > m_clip.y2 || x1 > x2)
+			return;
+
+		if (!m_vecTileCommands.empty())
+			FlushTiles();
 
-			if (p < 0) p += 4 * x++ + 6;
-			else p += 4 * (x++ - y--) + 10;
+		for (int i = x1; i <= x2; i++)
+		{
+			m_bufGlyphs[y * m_screenWidth + i] = m_glyphTable.Index(str[i - x]);
+			m_bufAttributes[y * m_screenWidth + i] = (unsigned char)color;
 		}
 
-		DrawLine({ center.x, center.y }, { center.x + radius - 1, center.y }, FG_RED);
-		//Pixelate({ center.x, center.y }, FG_BLUE);
+		MarkDirty({ x1, y }, { x2, y });
 	}
 
-	void FillCircle(const point_2d& center, int radius, COLOR color = FG_WHITE, PIXEL_TYPE pixelType = PIXEL_SOLID)
+	// Draws a recorded list, see DrawList
+	void ReplayDrawList(DrawList& list)
 	{
-		// Taken from wikipedia
-		int x = 0;
-		int y = radius;
-		int p = 3 - 2 * radius;
-		if (!radius) return;
+		if (list.m_vecOrder.size() != list.m_vecCommands.size())
+			list.SortByLayer();
+
+		if (!list.m_bCached || list.m_nCacheWidth != m_screenWidth || list.m_nCacheHeight != m_screenHeight || !(list.m_cacheClip == m_clip))
+			CacheDrawList(list);
+
+		if (!m_vecTileCommands.empty())
+			FlushTiles();
 
-		while (y >= x)
+		int nCell = 0;
+		for (const DrawList::sSpan& span : list.m_vecSpans)
 		{
-			// Modified to draw scan-lines instead of edges
-			DrawLine({ center.x - x, center.y - y }, { center.x + x, center.y - y });
-			DrawLine({ center.x - y, center.y - x }, { center.x + y, center.y - x });
-			DrawLine({ center.x - x, center.y + y }, { center.x + x, center.y + y });
-			DrawLine({ center.x - y, center.y + x }, { center.x + y, center.y + x });
-			if (p < 0) p += 4 * x++ + 6;
-			else p += 4 * (x++ - y--) + 10;
+			memcpy(m_bufGlyphs + span.nStart, list.m_vecGlyphs.data() + nCell, span.nLength);
+			memcpy(m_bufAttributes + span.nStart, list.m_vecAttributes.data() + nCell, span.nLength);
+			MarkDirty(span.nStart % m_screenWidth, span.nStart % m_screenWidth + span.nLength - 1, span.nStart / m_screenWidth);
+			nCell += span.nLength;
 		}
-	};
+	}
 
-	void DrawString(int x, int y, std::wstring str, COLOR color = FG_WHITE)
+	void ReplayCommand(const DrawList& list, const DrawList::sCommand& cmd)
+	{
+		switch (cmd.op)
+		{
+		case DrawList::OP_PIXEL:
+			Pixelate(cmd.p[0], cmd.color, cmd.pixelType);
+			break;
+		case DrawList::OP_FILL:
+			Fill(cmd.p[0], cmd.p[1], cmd.color, cmd.pixelType);
+			break;
+		case DrawList::OP_LINE:
+			DrawLine(cmd.p[0], cmd.p[1], cmd.color, cmd.pixelType);
+			break;
+		case DrawList::OP_FILL_TRIANGLE:
+			FillTriangle(cmd.p[0], cmd.p[1], cmd.p[2], cmd.color, cmd.pixelType);
+			break;
+		case DrawList::OP_FILL_TRIANGLE_EDGE:
+			FillTriangle(triangle(cmd.p[0], cmd.p[1], cmd.p[2], cmd.color, cmd.edgeColor), cmd.pixelType);
+			break;
+		case DrawList::OP_FILL_CIRCLE:
+			FillCircle(cmd.p[0], cmd.nValue, cmd.color, cmd.pixelType);
+			break;
+		case DrawList::OP_STRING:
+			DrawString(cmd.p[0].x, cmd.p[0].y, list.m_sText.substr(cmd.nValue, cmd.nLength), cmd.color);
+			break;
+		}
+	}
+
+	// Draws the list onto two scratch frames, one all zeroes and one all ones.
+	// The cells it writes are the ones which end up the same in both, and are
+	// kept as spans of the final glyphs and attributes
+	void CacheDrawList(DrawList& list)
 	{
-		for (size_t i = 0; i < str.size(); i++)
+		FlushTiles();
+
+		unsigned char* bufGlyphs = m_bufGlyphs;
+		unsigned char* bufAttributes = m_bufAttributes;
+		sDirtyRegion* dirty = m_dirty;
+		sDirtyRegion dirtyScratch;
+		dirtyScratch.Reset(m_screenWidth, m_screenHeight);
+		m_dirty = &dirtyScratch;
+
+		std::vector<unsigned char> vecFrames[2];
+		for (int n = 0; n < 2; n++)
+		{
+			vecFrames[n].assign(2 * m_screenWidth * m_screenHeight, (unsigned char)n);
+			SelectFrameBuffer(vecFrames[n].data());
+			for (int nCommand : list.m_vecOrder)
+				ReplayCommand(list, list.m_vecCommands[nCommand]);
+			FlushTiles();
+		}
+
+		m_bufGlyphs = bufGlyphs;
+		m_bufAttributes = bufAttributes;
+		m_dirty = dirty;
+
+		list.m_vecSpans.clear();
+		list.m_vecGlyphs.clear();
+		list.m_vecAttributes.clear();
+		int nPlane = m_screenWidth * m_screenHeight;
+		for (int y = dirtyScratch.nMinY; y <= dirtyScratch.nMaxY; y++)
 		{
-			m_bufScreenData[y * m_screenWidth + x + i].Char.UnicodeChar = str[i];
-			m_bufScreenData[y * m_screenWidth + x + i].Attributes = color;
+			for (int x = dirtyScratch.vecMinX[y]; x <= dirtyScratch.vecMaxX[y]; x++)
+			{
+				int i = y * m_screenWidth + x;
+				if (vecFrames[0][i] != vecFrames[1][i] || vecFrames[0][nPlane + i] != vecFrames[1][nPlane + i])
+					continue;
+
+				if (list.m_vecSpans.empty() || list.m_vecSpans.back().nStart + list.m_vecSpans.back().nLength != i || x == 0)
+					list.m_vecSpans.push_back({ i, 0 });
+				list.m_vecSpans.back().nLength++;
+				list.m_vecGlyphs.push_back(vecFrames[0][i]);
+				list.m_vecAttributes.push_back(vecFrames[0][nPlane + i]);
+			}
 		}
+
+		list.m_nCacheWidth = m_screenWidth;
+		list.m_nCacheHeight = m_screenHeight;
+		list.m_cacheClip = m_clip;
+		list.m_bCached = true;
 	}
 
 	void Clip(int& x, int& y)
@@ -593,13 +3589,15 @@ protected:
 	void RotateTriangle(const point_2d& p, float fAngle, triangle& rotatedTriangle, const triangle& tri)
 	{
 		mat3x3 mat_transrotate;
-
-		mat_transrotate.m[0][0] = cos(fAngle);
-		mat_transrotate.m[0][1] = -sin(fAngle);
-		mat_transrotate.m[0][2] = p.x * (1.0f - cos(fAngle)) + p.y * sin(fAngle);
-		mat_transrotate.m[1][0] = sin(fAngle);
-		mat_transrotate.m[1][1] = cos(fAngle);
-		mat_transrotate.m[1][2] = p.y * (1.0f - cos(fAngle)) - p.x * sin(fAngle);
+		auto c = cos(fAngle);
+		auto s = sin(fAngle);
+
+		mat_transrotate.m[0][0] = c;
+		mat_transrotate.m[0][1] = -s;
+		mat_transrotate.m[0][2] = p.x * (1.0f - c) + p.y * s;
+		mat_transrotate.m[1][0] = s;
+		mat_transrotate.m[1][1] = c;
+		mat_transrotate.m[1][2] = p.y * (1.0f - c) - p.x * s;
 		mat_transrotate.m[2][2] = 1;
 
 		MultiplyMatrix3x3(tri.p[0], rotatedTriangle.p[0], mat_transrotate);
@@ -610,12 +3608,14 @@ protected:
 	void RotateTriangle1(const point_2d& p, float fAngle, triangle& rotatedTriangle, const triangle& tri)
 	{
 		mat3x3 mat_rotation;
-		mat_rotation.m[0][0] = cos(fAngle);
-		mat_rotation.m[0][1] = sin(fAngle);
-		mat_rotation.m[1][0] = -sin(fAngle);
-		mat_rotation.m[1][1] = cos(fAngle);
-		mat_rotation.m[2][0] = -p.x * (1.0f - cos(fAngle)) + p.y * sin(fAngle);
-		mat_rotation.m[2][1] = p.y * (1.0f - cos(fAngle)) - p.x * sin(fAngle);
+		auto c = cos(fAngle);
+		auto s = sin(fAngle);
+		mat_rotation.m[0][0] = c;
+		mat_rotation.m[0][1] = s;
+		mat_rotation.m[1][0] = -s;
+		mat_rotation.m[1][1] = c;
+		mat_rotation.m[2][0] = -p.x * (1.0f - c) + p.y * s;
+		mat_rotation.m[2][1] = p.y * (1.0f - c) - p.x * s;
 		mat_rotation.m[2][2] = 1.0f;
 
 		MultiplyMatrix3x3(tri.p[0], rotatedTriangle.p[0], mat_rotation);
@@ -637,18 +3637,17 @@ protected:
 		MultiplyMatrix3x3(tri.p[2], translatedTriangle.p[2], mat_translate);
 	}
 
+	// True inside the triangle or on one of its edges, whichever way it winds
 	bool IsPointInsideTriangle(const point_2d& p, const point_2d& p1, const point_2d& p2, const point_2d& p3)
 	{
-		auto area = [](point_2d _p1, point_2d _p2, point_2d _p3) {
-			return (float)std::abs((_p1.x * (_p2.y - _p3.y) + _p2.x * (_p3.y - _p1.y) + _p3.x * (_p1.y - _p2.y)) / 2.0);
+		auto edge = [&p](const point_2d& a, const point_2d& b) {
+			return (long long)(b.x - a.x) * (p.y - a.y) - (long long)(b.y - a.y) * (p.x - a.x);
 			};
 
-		float fAreaTriangle = area(p1, p2, p3);
-		float fA1 = area(p, p2, p3);
-		float fA2 = area(p1, p, p3);
-		float fA3 = area(p1, p2, p);
-
-		return (fAreaTriangle == fA1 + fA2 + fA3);
+		long long w1 = edge(p1, p2), w2 = edge(p2, p3), w3 = edge(p3, p1);
+		bool bNegative = w1 < 0 || w2 < 0 || w3 < 0;
+		bool bPositive = w1 > 0 || w2 > 0 || w3 > 0;
+		return !(bNegative && bPositive);
 	}
 
 	float Random()
@@ -667,23 +3666,40 @@ public:
 		m_screenHeight = 80;
 		m_screenWidth = 30;
 
+#ifdef _WIN32
 		m_hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
 		m_hConsoleInput = GetStdHandle(STD_INPUT_HANDLE);
+#endif
 
 		// Set all keystates to be zero initialized
-		std::memset(m_keyOldState, 0, 256 * sizeof(short));
-		std::memset(m_keyNewState, 0, 256 * sizeof(short));
-		std::memset(m_keys, 0, 256 * sizeof(short));
+		std::memset(m_keys, 0, sizeof(m_keys));
+		std::memset(m_mouse, 0, sizeof(m_mouse));
 	}
 
 	~CrabbyGraphics()
 	{
+		StopInputThread();
+		StopPresentThread();
+		StopTelemetryCSV();
+		m_recorder.Stop();
+
+		if (m_bHeadless)
+		{
+			FreeFrameBuffers();
+			return;
+		}
+
+#ifdef _WIN32
 		SetConsoleActiveScreenBuffer(m_hOriginalConsole);
+#else
+		RestoreTerminal();
+#endif
 		//delete[] m_bufScreenData
 	}
 
 	int ConstructConsole(int width, int height, int fontWidth, int fontHeight)
 	{
+#ifdef _WIN32
 		if (m_hConsole == INVALID_HANDLE_VALUE)
 			GraphicError(L"Bad Output Handle Error");
 
@@ -730,11 +3746,8 @@ public:
 		if (!SetConsoleMode(m_hConsoleInput, ENABLE_EXTENDED_FLAGS | ENABLE_WINDOW_INPUT | ENABLE_MOUSE_INPUT))
 			return GraphicError(L"Cannot get keyboard/mouse inputs");
 
-		// Allocate memory for screen buffer
-		m_bufScreenData = new CHAR_INFO[m_screenWidth * m_screenHeight];
-
-		// Initalize all values to zero
-		memset(m_bufScreenData, 0, sizeof(CHAR_INFO) * m_screenWidth * m_screenHeight);
+		// Allocate memory for the screen buffers
+		AllocateFrameBuffers(m_nFrameBuffers);
 
 		SetConsoleCtrlHandler((PHANDLER_ROUTINE)ControlCloseHandler, TRUE);
 
@@ -751,6 +3764,110 @@ public:
 		}
 
 		return 1;
+#else
+		// The font belongs to the terminal emulator, so fontWidth and fontHeight
+		// can't be applied here
+		(void)fontWidth;
+		(void)fontHeight;
+		m_screenWidth = width;
+		m_screenHeight = height;
+
+		if (!isatty(STDOUT_FILENO))
+			return GraphicError(L"Output is not a terminal");
+
+		// Check whether the screen fits inside the terminal
+		winsize ws;
+		if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == -1)
+			return GraphicError(L"Cannot get terminal information");
+		if (m_screenHeight > ws.ws_row)
+			return GraphicError(L"Screen Height too large for the terminal");
+		if (m_screenWidth > ws.ws_col)
+			return GraphicError(L"Screen Width too large for the terminal");
+
+		// Stop typed keys from being echoed over the frame
+		if (isatty(STDIN_FILENO) && tcgetattr(STDIN_FILENO, &m_termOriginal) == 0)
+		{
+			termios term = m_termOriginal;
+			term.c_lflag &= ~(ECHO | ICANON);
+			if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &term) == 0)
+				m_bTermModeChanged = true;
+		}
+
+		// Switch to the alternate screen, hide the cursor, disable auto-wrap, clear,
+		// and turn on mouse (any motion, SGR coordinates) and focus reporting
+		const char* seq = "\x1b[?1049h\x1b[?25l\x1b[?7l\x1b[2J\x1b[?1003h\x1b[?1006h\x1b[?1004h";
+		WriteTerminal(seq, strlen(seq));
+		m_bTermActive = true;
+
+		// Allocate memory for the screen buffers and the last presented frame
+		AllocateFrameBuffers(m_nFrameBuffers);
+		m_vtEncoder.Reset(m_screenWidth, m_screenHeight);
+
+		// REP isn't part of every terminal, only use it on the ones known to have it
+		const char* sTerm = getenv("TERM");
+		if (sTerm && !m_bVTRepeatSet)
+		{
+			for (const char* sKnown : { "xterm", "kitty", "foot", "alacritty", "wezterm", "tmux", "ghostty" })
+				if (strstr(sTerm, sKnown))
+					m_vtEncoder.SetRepeat(true);
+		}
+
+		signal(SIGINT, ControlCloseHandler);
+		signal(SIGTERM, ControlCloseHandler);
+		signal(SIGHUP, ControlCloseHandler);
+
+		return 1;
+#endif
+	}
+
+	// Number of screen buffers in the present ring, call before ConstructConsole.
+	// 1 presents on the game thread like before, 2 or 3 let the game draw the
+	// next frame while the previous one is being written to the console
+	void SetFrameBuffers(int nBuffers)
+	{
+		m_nFrameBuffers = (std::max)(1, (std::min)(nBuffers, MAX_FRAME_BUFFERS));
+	}
+
+	// Rasterizes Fill, FillTriangle and FillCircle in tiles of 32x16 cells on
+	// nThreads threads, the game thread being one of them. They are binned as
+	// they're called and drawn at the end of Update, or as soon as anything else
+	// is drawn. The frames come out the same as without it, 0 turns it off
+	void SetTiledRendering(int nThreads)
+	{
+		FlushTiles();
+		m_bTiled = nThreads > 0;
+		m_tileWorkers.Start((std::max)(0, nThreads - 1));
+	}
+
+	// How many rasterized shapes to keep, the least recently drawn are dropped
+	// first. 0 stops triangles being cached, circles are still drawn from spans
+	void SetRasterCacheSize(int nEntries) { m_rasterCache.SetCapacity((std::max)(0, nEntries)); }
+
+	// Hits and misses of the raster cache since the start, for sizing it
+	sRasterCacheStats GetRasterCacheStats() const { return m_rasterCache.Stats(); }
+
+	// How the game thread paces frames, call before Start. With PACING_FIXED
+	// the thread sleeps between frames instead of spinning at 100% of a core,
+	// and bHalfRateUnfocused halves the rate while the console isn't focused
+	void SetFramePacing(FRAME_PACING pacing, float fTargetFPS = 60.0f, bool bHalfRateUnfocused = true)
+	{
+		m_framePacing = pacing;
+		m_fTargetFPS = fTargetFPS > 0.0f ? fTargetFPS : 60.0f;
+		m_bHalfRateUnfocused = bHalfRateUnfocused;
+	}
+
+	// VT backend options. bRepeat overrides whether runs are sent with REP, which
+	// is otherwise guessed from $TERM, whether it's called before or after
+	// ConstructConsole. nByteBudget caps the bytes sent per frame with the
+	// remaining changes following in later frames (0 for no limit).
+	// Nothing changes with the Windows console
+	void SetVTOptions(bool bRepeat, int nByteBudget = 0)
+	{
+#ifndef _WIN32
+		m_vtEncoder.SetRepeat(bRepeat);
+		m_vtEncoder.SetByteBudget(nByteBudget);
+		m_bVTRepeatSet = true;
+#endif
 	}
 
 	void Start()
@@ -763,6 +3880,178 @@ public:
 		gameThread.join();
 	}
 
+	// Headless mode - the screen buffer only lives in memory and nothing is
+	// presented, so games can run without a console (benchmarks, CI)
+	int ConstructHeadless(int width, int height)
+	{
+		m_screenWidth = width;
+		m_screenHeight = height;
+		m_bHeadless = true;
+
+		AllocateFrameBuffers(1);
+
+		return 1;
+	}
+
+	// Steps Update nFrames times with a fixed fElapsedTime, as fast as possible.
+	// onFrame is called before every frame with the frame number and can feed
+	// scripted input through SetKeyState/SetMouseState/SetMousePos.
+	// Returns the number of frames run, which is less than nFrames if Update
+	// or Setup asked to quit
+	int RunHeadless(int nFrames, float fElapsedTime, std::function<void(int)> onFrame = nullptr)
+	{
+		if (!m_bHeadless)
+			return 0;
+
+		if (!m_bHeadlessSetup)
+		{
+			if (!Setup())
+				return 0;
+			m_bHeadlessSetup = true;
+		}
+
+		for (int nFrame = 0; nFrame < nFrames; nFrame++)
+		{
+			if (onFrame)
+				onFrame(nFrame);
+
+			m_dirty->Reset(m_screenWidth, m_screenHeight);
+
+			auto tpInput = std::chrono::steady_clock::now();
+			ProcessInputEvents();
+			auto tpUpdate = std::chrono::steady_clock::now();
+			bool bContinue = Update(fElapsedTime);
+			FlushTiles();
+			m_rasterCache.NextFrame();
+			if (m_recorder.IsRecording())
+				m_recorder.RecordFrame(m_bufGlyphs, m_bufAttributes, m_glyphTable, *m_dirty, fElapsedTime);
+			if (m_sharedFrame.IsOpen())
+				m_sharedFrame.Publish(m_bufGlyphs, m_bufAttributes, m_glyphTable, fElapsedTime);
+
+			std::chrono::duration<float> inputTime = tpUpdate - tpInput;
+			std::chrono::duration<float> updateTime = std::chrono::steady_clock::now() - tpUpdate;
+			RecordFrameTiming(inputTime.count(), updateTime.count(), 0.0f, fElapsedTime);
+			CompleteFrameTiming(m_nTimingsRecorded - 1, 0.0f);
+
+			if (!bContinue)
+				return nFrame + 1;
+		}
+
+		return nFrames;
+	}
+
+	// Scripted input for headless runs, queued like real input and applied at
+	// the start of the next frame. Setting the same state again does nothing
+	void SetKeyState(int nKeyID, bool bDown)
+	{
+		if (m_bKeyDown[nKeyID] != bDown)
+			PushInputEvent(EVENT_KEY, nKeyID, bDown);
+		m_bKeyDown[nKeyID] = bDown;
+	}
+
+	void SetMouseState(int nMouseButtonID, bool bDown)
+	{
+		if (m_bMouseDown[nMouseButtonID] != bDown)
+			PushInputEvent(EVENT_MOUSE_BUTTON, nMouseButtonID, bDown);
+		m_bMouseDown[nMouseButtonID] = bDown;
+	}
+
+	void SetMousePos(int x, int y) { PushInputEvent(EVENT_MOUSE_MOVE, 0, false, x, y); }
+
+	// Percentiles of one phase over the last TELEMETRY_FRAMES completed frames, in seconds
+	sFrameStats GetFrameStats(FRAME_PHASE phase) const
+	{
+		long long nFirst = (std::max)(0LL, m_nTimingsRecorded - TELEMETRY_FRAMES);
+		std::vector<float> vecTimes;
+		for (long long i = nFirst; i < m_nTimingsComplete; i++)
+			vecTimes.push_back(m_vecFrameTimings[i % TELEMETRY_FRAMES].fPhase[phase]);
+
+		sFrameStats stats = { 0.0f, 0.0f, 0.0f, 0.0f, (int)vecTimes.size() };
+		if (vecTimes.empty())
+			return stats;
+
+		std::sort(vecTimes.begin(), vecTimes.end());
+		auto Percentile = [&](float p) { return vecTimes[(size_t)(p * (vecTimes.size() - 1) + 0.5f)]; };
+		stats.fP50 = Percentile(0.50f);
+		stats.fP95 = Percentile(0.95f);
+		stats.fP99 = Percentile(0.99f);
+		stats.fMax = vecTimes.back();
+		return stats;
+	}
+
+	// Streams every completed frame's timings (in milliseconds) to a CSV file from
+	// a background thread. Frames are dropped rather than stalling the game if
+	// the writer falls behind, see GetTelemetryDropped
+	bool StartTelemetryCSV(const std::string& sFile)
+	{
+		if (m_telemetryThread.joinable())
+			return false;
+
+		m_fileTelemetryCSV.open(sFile, std::ios::out | std::ios::trunc);
+		if (!m_fileTelemetryCSV)
+			return false;
+
+		m_fileTelemetryCSV << "frame,input_ms,update_ms,submit_ms,present_ms,frame_ms\n";
+		m_bTelemetryQuit = false;
+		m_telemetryThread = std::thread(&CrabbyGraphics::TelemetryThread, this);
+		return true;
+	}
+
+	long long GetTelemetryDropped() const { return m_nTelemetryDropped; }
+
+	// Records every frame from here on to a .cgr file for the Recording Player,
+	// call after ConstructConsole or ConstructHeadless. Frames are delta and run
+	// length encoded as they are submitted and written out by a background thread
+	bool StartRecording(const std::string& sFile)
+	{
+		if (!m_bufGlyphs)
+			return false;
+
+		return m_recorder.Start(sFile, m_screenWidth, m_screenHeight);
+	}
+
+	void StopRecording() { m_recorder.Stop(); }
+
+	// Publishes every presented frame to named shared memory so other processes
+	// can read it without scraping the console, see SharedFrameBuffer. Call after
+	// ConstructConsole or ConstructHeadless. With more than one frame buffer the
+	// copy happens on the present thread, not the game thread. Fails, restoring
+	// the console, if the name is taken by another game or one that crashed
+	bool StartFrameExport(const std::string& sName)
+	{
+		if (!m_bufGlyphs)
+			return false;
+
+		if (!m_sharedFrame.Create(sName, m_screenWidth, m_screenHeight))
+			return GraphicError(L"Cannot create shared memory for frames, the name may be in use by another game");
+
+		return true;
+	}
+
+	// Reseeds the engine's random number generator so runs can be reproduced
+	void SetRandomSeed(unsigned int nSeed) { Random::mt.seed(nSeed); }
+
+	// One cell of the screen buffer in the console's format
+	CHAR_INFO GetCell(int x, int y) const
+	{
+		CHAR_INFO cell;
+		cell.Char.UnicodeChar = m_glyphTable.Glyph(m_bufGlyphs[y * m_screenWidth + x]);
+		cell.Attributes = m_bufAttributes[y * m_screenWidth + x];
+		return cell;
+	}
+
+	// FNV-1a hash of the screen buffer, for comparing frames between runs
+	unsigned int GetFrameChecksum() const
+	{
+		unsigned int hash = 2166136261u;
+		for (int i = 0; i < m_screenWidth * m_screenHeight; i++)
+		{
+			hash = (hash ^ (unsigned int)m_glyphTable.Glyph(m_bufGlyphs[i])) * 16777619u;
+			hash = (hash ^ (unsigned int)m_bufAttributes[i]) * 16777619u;
+		}
+		return hash;
+	}
+
 // Virtual functions
 protected:
 	// These functions has to be overriden
@@ -1,7 +1,9 @@
 #include <iostream>
 #include <fstream>
 #include <list>
+#ifdef _WIN32
 #include <windows.h>
+#endif
 #include "CrabbyGraphics.h"
 
 class Console : public CrabbyGraphics
@@ -105,10 +107,10 @@ public:
 
 			// Collision detection
 			bHasCollided = fBirdPosition < -2 || fBirdPosition > ScreenHeight() + 2 ||
-				m_bufScreenData[(int)(fBirdPosition + 0) * ScreenWidth() + nBirdX].Attributes == FG_GREEN ||
-				m_bufScreenData[(int)(fBirdPosition + 1) * ScreenWidth() + nBirdX].Attributes == FG_GREEN ||
-				m_bufScreenData[(int)(fBirdPosition + 0) * ScreenWidth() + nBirdX + 6].Attributes == FG_GREEN ||
-				m_bufScreenData[(int)(fBirdPosition + 1) * ScreenWidth() + nBirdX + 6].Attributes == FG_GREEN;
+				m_bufAttributes[(int)(fBirdPosition + 0) * ScreenWidth() + nBirdX] == FG_GREEN ||
+				m_bufAttributes[(int)(fBirdPosition + 1) * ScreenWidth() + nBirdX] == FG_GREEN ||
+				m_bufAttributes[(int)(fBirdPosition + 0) * ScreenWidth() + nBirdX + 6] == FG_GREEN ||
+				m_bufAttributes[(int)(fBirdPosition + 1) * ScreenWidth() + nBirdX + 6] == FG_GREEN;
 
 			// Draw bird
 
@@ -134,12 +136,52 @@ public:
 	}
 };
 
-int main()
+int main(int argc, char* argv[])
 {
 	Console console;
 
+	// FlappyBird --headless <frames> [seed] [recording.cgr]
+	// Runs a scripted game without a console at a fixed 60 Hz step, for benchmarks and regression checks
+	if (argc > 2 && std::string(argv[1]) == "--headless")
+	{
+		int nFrames = std::stoi(argv[2]);
+		console.SetRandomSeed(argc > 3 ? std::stoul(argv[3]) : 1);
+		console.ConstructHeadless(80, 40);
+		if (argc > 4)
+			console.StartRecording(argv[4]);
+
+		auto tp1 = std::chrono::steady_clock::now();
+		int nFramesRun = console.RunHeadless(nFrames, 1.0f / 60.0f, [&](int nFrame) {
+			// Flap every half a second, which also restarts the game after a crash
+			console.SetKeyState(VK_SPACE, nFrame % 30 < 2);
+		});
+		std::chrono::duration<double> elapsedTime = std::chrono::steady_clock::now() - tp1;
+
+		std::wcout << nFramesRun << L" frames in " << elapsedTime.count() << L"s (" << nFramesRun / elapsedTime.count() << L" FPS), checksum " << std::hex << console.GetFrameChecksum() << std::endl;
+
+		sFrameStats update = console.GetFrameStats(PHASE_UPDATE);
+		std::wcout << std::dec << L"Update ms - p50: " << update.fP50 * 1000.0f << L" p95: " << update.fP95 * 1000.0f << L" p99: " << update.fP99 * 1000.0f << L" max: " << update.fMax * 1000.0f << std::endl;
+		return 0;
+	}
+
+	// --telemetry <file.csv> streams per frame timings while playing
+	if (argc > 2 && std::string(argv[1]) == "--telemetry")
+		console.StartTelemetryCSV(argv[2]);
+
+	console.SetFramePacing(PACING_FIXED, 60.0f);
+
 	if (console.ConstructConsole(80, 40, 16, 16))
+	{
+		// --record <file.cgr> records the game for the Recording Player
+		if (argc > 2 && std::string(argv[1]) == "--record")
+			console.StartRecording(argv[2]);
+
+		// --share <name> publishes frames to shared memory for external viewers
+		if (argc > 2 && std::string(argv[1]) == "--share" && !console.StartFrameExport(argv[2]))
+			return 1;
+
 		console.Start();
+	}
 	else
 		std::wcout << L"Select a different screen resolution/font dimension." << std::endl;
 
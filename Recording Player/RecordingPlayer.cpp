@@ -0,0 +1,385 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "CrabbyGraphics.h"
+
+class Player : public CrabbyGraphics
+{
+private:
+	FrameRecordingReader& reader;
+	bool bMaxSpeed;						// one recorded frame per frame instead of the recorded timing
+	float fPlaybackTime = 0.0f;			// time since playback started
+	float fFrameDue = 0.0f;				// time the pending frame was recorded at
+	bool bFramePending = false;			// a frame has been read but not shown yet
+
+	// Copies the cells changed by the last frame read onto the screen
+	void ShowFrame()
+	{
+		const CHAR_INFO* bufFrame = reader.GetFrame();
+		const sDirtyRegion& dirty = reader.GetDirty();
+
+		for (int y = dirty.nMinY; y <= dirty.nMaxY; y++)
+		{
+			int x1 = dirty.vecMinX[y], x2 = dirty.vecMaxX[y];
+			if (x1 > x2)
+				continue;
+
+			for (int i = y * ScreenWidth() + x1; i <= y * ScreenWidth() + x2; i++)
+			{
+				m_bufGlyphs[i] = GlyphIndex(bufFrame[i].Char.UnicodeChar);
+				m_bufAttributes[i] = (unsigned char)bufFrame[i].Attributes;
+			}
+			MarkDirty(x1, x2, y);
+		}
+	}
+
+public:
+	Player(FrameRecordingReader& reader, bool bMaxSpeed) : reader(reader), bMaxSpeed(bMaxSpeed)
+	{
+	}
+
+	bool Setup() override
+	{
+		return true;
+	}
+
+	bool Update(float fElapsedTime) override
+	{
+		if (GetKey(VK_ESCAPE).bPressed)
+			return false;
+
+		// Show every frame which is due by now, and read ahead to find out when
+		// the next one is
+		fPlaybackTime += fElapsedTime;
+		do
+		{
+			if (bFramePending)
+				ShowFrame();
+
+			float fFrameTime;
+			if (!reader.ReadFrame(fFrameTime))
+				return false;
+
+			fFrameDue += fFrameTime;
+			bFramePending = true;
+		} while (!bMaxSpeed && fFrameDue <= fPlaybackTime);
+
+		return true;
+	}
+};
+
+// Copies the cells changed by the last frame read into glyph and attribute planes,
+// which is what VTEncoder works on. The recording has characters
+void CopyFrame(FrameRecordingReader& reader, GlyphTable& glyphTable, std::vector<unsigned char>& vecGlyphs, std::vector<unsigned char>& vecAttributes)
+{
+	const CHAR_INFO* bufFrame = reader.GetFrame();
+	const sDirtyRegion& dirty = reader.GetDirty();
+	for (int y = dirty.nMinY; y <= dirty.nMaxY; y++)
+	{
+		for (int i = y * reader.GetWidth() + dirty.vecMinX[y]; i <= y * reader.GetWidth() + dirty.vecMaxX[y]; i++)
+		{
+			vecGlyphs[i] = glyphTable.Index(bufFrame[i].Char.UnicodeChar);
+			vecAttributes[i] = (unsigned char)bufFrame[i].Attributes;
+		}
+	}
+}
+
+// Writes the recording as an asciicast v2 file (asciinema), one output event per frame
+int ExportAsciicast(FrameRecordingReader& reader, const std::string& sFile)
+{
+	std::ofstream file(sFile, std::ios::out | std::ios::binary | std::ios::trunc);
+	if (!file)
+	{
+		std::wcout << L"Cannot create " << sFile.c_str() << std::endl;
+		return 1;
+	}
+
+	file << "{\"version\": 2, \"width\": " << reader.GetWidth() << ", \"height\": " << reader.GetHeight() << "}\n";
+
+	int nCells = reader.GetWidth() * reader.GetHeight();
+	std::vector<unsigned char> vecGlyphs(nCells), vecAttributes(nCells);
+	GlyphTable glyphTable;
+
+	VTEncoder encoder;
+	encoder.Reset(reader.GetWidth(), reader.GetHeight());
+
+	// Hide the cursor, disable auto-wrap and clear before the first frame
+	std::string out = "\x1b[?25l\x1b[?7l\x1b[2J";
+	std::string event;
+	double fTime = 0.0;
+	float fFrameTime;
+	int nFrames = 0;
+
+	while (reader.ReadFrame(fFrameTime))
+	{
+		fTime += fFrameTime;
+		nFrames++;
+
+		CopyFrame(reader, glyphTable, vecGlyphs, vecAttributes);
+		encoder.Encode(vecGlyphs.data(), vecAttributes.data(), glyphTable, reader.GetDirty(), out);
+		if (out.empty())
+			continue;
+
+		char sTime[32];
+		snprintf(sTime, sizeof(sTime), "%.6f", fTime);
+		event = "[";
+		event += sTime;
+		event += ", \"o\", \"";
+
+		// JSON string - UTF-8 passes through, control characters are escaped
+		for (unsigned char c : out)
+		{
+			if (c == '"' || c == '\\')
+			{
+				event += '\\';
+				event += (char)c;
+			}
+			else if (c < 0x20)
+			{
+				char sEscape[8];
+				snprintf(sEscape, sizeof(sEscape), "\\u%04x", c);
+				event += sEscape;
+			}
+			else
+				event += (char)c;
+		}
+
+		event += "\"]\n";
+		file << event;
+		out.clear();
+	}
+
+	std::wcout << nFrames << L" frames, " << fTime << L"s written to " << sFile.c_str() << std::endl;
+	return 0;
+}
+
+// Just enough of a terminal to replay what VTEncoder sends - UTF-8 text without
+// auto-wrap, cursor position and forward, REP, and the 16 color SGR codes
+class VTScreen
+{
+	int nWidth, nHeight;
+	int nCursorX = 0, nCursorY = 0;
+	int nAttributes = 0;
+	wchar_t lastGlyph = L' ';
+
+	void Put(wchar_t c)
+	{
+		if (nCursorX < nWidth && nCursorY < nHeight)
+		{
+			vecCells[nCursorY * nWidth + nCursorX].Char.UnicodeChar = c;
+			vecCells[nCursorY * nWidth + nCursorX].Attributes = (unsigned short)nAttributes;
+		}
+		nCursorX = (std::min)(nCursorX + 1, nWidth);
+		lastGlyph = c;
+	}
+
+	// ANSI colors have red in the lowest bit, console attributes blue
+	static int ANSIToAttribute(int nCode)
+	{
+		return ((nCode & 0x1) << 2) | (nCode & 0x2) | ((nCode & 0x4) >> 2);
+	}
+
+public:
+	std::vector<CHAR_INFO> vecCells;
+
+	VTScreen(int nWidth, int nHeight) : nWidth(nWidth), nHeight(nHeight), vecCells(nWidth * nHeight)
+	{
+	}
+
+	// Returns false on anything VTEncoder shouldn't have sent
+	bool Feed(const std::string& s)
+	{
+		size_t i = 0;
+		while (i < s.size())
+		{
+			unsigned char c = s[i];
+			if (c == 0x1b)
+			{
+				if (i + 1 >= s.size() || s[i + 1] != '[')
+					return false;
+
+				std::vector<int> vecParams(1, 0);
+				for (i += 2; i < s.size() && (isdigit((unsigned char)s[i]) || s[i] == ';'); i++)
+				{
+					if (s[i] == ';')
+						vecParams.push_back(0);
+					else
+						vecParams.back() = vecParams.back() * 10 + (s[i] - '0');
+				}
+				if (i >= s.size())
+					return false;
+
+				int n = (std::max)(vecParams[0], 1);
+				switch (s[i++])
+				{
+				case 'H':
+					if (vecParams.size() != 2)
+						return false;
+					nCursorY = vecParams[0] - 1;
+					nCursorX = vecParams[1] - 1;
+					break;
+
+				case 'C':
+					nCursorX = (std::min)(nCursorX + n, nWidth - 1);
+					break;
+
+				case 'b':
+					for (int k = 0; k < n; k++)
+						Put(lastGlyph);
+					break;
+
+				case 'm':
+					for (int nCode : vecParams)
+					{
+						if (nCode >= 30 && nCode <= 37) nAttributes = (nAttributes & 0xF0) | ANSIToAttribute(nCode - 30);
+						else if (nCode >= 90 && nCode <= 97) nAttributes = (nAttributes & 0xF0) | 0x08 | ANSIToAttribute(nCode - 90);
+						else if (nCode >= 40 && nCode <= 47) nAttributes = (nAttributes & 0x0F) | ANSIToAttribute(nCode - 40) << 4;
+						else if (nCode >= 100 && nCode <= 107) nAttributes = (nAttributes & 0x0F) | (0x08 | ANSIToAttribute(nCode - 100)) << 4;
+						else return false;
+					}
+					break;
+
+				default:
+					return false;
+				}
+				continue;
+			}
+
+			// UTF-8
+			int nLength = c < 0x80 ? 1 : c < 0xE0 ? 2 : c < 0xF0 ? 3 : 4;
+			if (i + nLength > s.size())
+				return false;
+			unsigned int cp = nLength == 1 ? c : c & (0xFF >> (nLength + 1));
+			for (int k = 1; k < nLength; k++)
+				cp = (cp << 6) | (s[i + k] & 0x3F);
+			Put((wchar_t)cp);
+			i += nLength;
+		}
+		return true;
+	}
+};
+
+// Encodes the recording with VTEncoder as the terminal backend would, plays the
+// output back through VTScreen and compares it with the recorded frames. Runs
+// without REP, with REP, and with REP and a byte budget, where frames can lag
+// behind and only the last one is compared once everything has been sent
+int CheckVTEncoding(const std::string& sFile)
+{
+	struct sConfig
+	{
+		const wchar_t* sName;
+		bool bRepeat;
+		int nByteBudget;
+	};
+	const sConfig configs[] = { { L"plain", false, 0 }, { L"REP", true, 0 }, { L"REP, 300 byte budget", true, 300 } };
+
+	int nFailed = 0;
+	for (const sConfig& config : configs)
+	{
+		FrameRecordingReader reader;
+		if (!reader.Open(sFile))
+			return 1;
+
+		int nWidth = reader.GetWidth(), nHeight = reader.GetHeight();
+		std::vector<unsigned char> vecGlyphs(nWidth * nHeight), vecAttributes(nWidth * nHeight);
+		GlyphTable glyphTable;
+		VTScreen screen(nWidth, nHeight);
+
+		VTEncoder encoder;
+		encoder.Reset(nWidth, nHeight);
+		encoder.SetRepeat(config.bRepeat);
+		encoder.SetByteBudget(config.nByteBudget);
+
+		std::string out;
+		long long nBytes = 0;
+		int nFrames = 0, nBadFrames = 0;
+		bool bValid = true;
+
+		auto Send = [&](const sDirtyRegion& dirty) {
+			encoder.Encode(vecGlyphs.data(), vecAttributes.data(), glyphTable, dirty, out);
+			bValid = screen.Feed(out) && bValid;
+			nBytes += out.size();
+			bool bSent = !out.empty();
+			out.clear();
+			return bSent;
+		};
+
+		auto Matches = [&]() {
+			const CHAR_INFO* bufFrame = reader.GetFrame();
+			for (int i = 0; i < nWidth * nHeight; i++)
+			{
+				wchar_t glyph = bufFrame[i].Char.UnicodeChar ? bufFrame[i].Char.UnicodeChar : L' ';
+				if (screen.vecCells[i].Char.UnicodeChar != glyph || screen.vecCells[i].Attributes != (unsigned char)bufFrame[i].Attributes)
+					return false;
+			}
+			return true;
+		};
+
+		float fFrameTime;
+		while (reader.ReadFrame(fFrameTime))
+		{
+			nFrames++;
+			CopyFrame(reader, glyphTable, vecGlyphs, vecAttributes);
+			Send(reader.GetDirty());
+
+			if (!config.nByteBudget && !Matches())
+				nBadFrames++;
+		}
+
+		// Send whatever the budget held back
+		sDirtyRegion none;
+		none.Reset(nWidth, nHeight);
+		for (int i = 0; i < nWidth * nHeight && Send(none); i++)
+			;
+		if (!Matches())
+			nBadFrames++;
+
+		bool bPassed = bValid && nBadFrames == 0;
+		std::wcout << config.sName << L": " << nFrames << L" frames, " << nBytes << L" bytes, "
+			<< (bPassed ? L"ok" : bValid ? L"frames differ" : L"unexpected sequence") << std::endl;
+		if (!bPassed)
+			nFailed++;
+	}
+
+	return nFailed ? 1 : 0;
+}
+
+int main(int argc, char* argv[])
+{
+	// RecordingPlayer <recording.cgr> [--max-speed]
+	// RecordingPlayer <recording.cgr> --asciicast <output.cast>
+	// RecordingPlayer <recording.cgr> --vt-check
+	if (argc < 2)
+	{
+		std::wcout << L"Usage: RecordingPlayer <recording.cgr> [--max-speed | --asciicast <output.cast> | --vt-check]" << std::endl;
+		return 1;
+	}
+
+	FrameRecordingReader reader;
+	if (!reader.Open(argv[1]))
+	{
+		std::wcout << L"Cannot open " << argv[1] << L", or it isn't a recording." << std::endl;
+		return 1;
+	}
+
+	std::string sOption = argc > 2 ? argv[2] : "";
+	if (sOption == "--asciicast" && argc > 3)
+		return ExportAsciicast(reader, argv[3]);
+	if (sOption == "--vt-check")
+		return CheckVTEncoding(argv[1]);
+
+	bool bMaxSpeed = sOption == "--max-speed";
+	Player player(reader, bMaxSpeed);
+
+	// Recorded frames land between presented ones, so present more often than
+	// the games run to keep the timing close
+	player.SetFramePacing(bMaxSpeed ? PACING_UNCAPPED : PACING_FIXED, 120.0f, false);
+
+	if (player.ConstructConsole(reader.GetWidth(), reader.GetHeight(), 8, 8))
+		player.Start();
+	else
+		std::wcout << L"Select a different screen resolution/font dimension." << std::endl;
+
+	return 0;
+}
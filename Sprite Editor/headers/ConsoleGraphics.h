@@ -10,6 +10,8 @@
 *	* Optimizations (1.0.1)
 *	* Console closes only when window is active (1.0.2)
 *	* Added sprites
+*	* Versioned binary sprite files with a CRC, memory mapped on load
+*	* Clipped sprite blits with transparency
 * 
 *	TODO:
 *	* Add scroll wheel events
@@ -27,6 +29,8 @@
 #include "random.h"
 
 #include <iostream>
+#include <string>
+#include <cstring>
 #include <algorithm>
 #include <vector>
 #include <cmath>
@@ -87,12 +91,243 @@ enum PIXEL_TYPE
 };
 
 
+// Sprite files, version 1. Everything is little-endian and the cells are stored
+// exactly as CHAR_INFO lays them out in memory (glyph, then attributes), so an
+// uncompressed sprite is drawn straight out of the mapped file:
+//   sSpriteFileHeader
+//   payload of nPayloadSize bytes, nWidth * nHeight cells, RLE packed if nCompression says so
+// Files without the magic are the old ones (two ints and a short per cell, written in text mode)
+enum SPRITE_PIXEL_FORMAT
+{
+	SPRITE_PIXEL_CHAR_INFO = 1,
+};
+
+enum SPRITE_COMPRESSION
+{
+	SPRITE_COMPRESSION_NONE = 0,
+	SPRITE_COMPRESSION_RLE = 1,		// a short count, high bit set for a run of one cell, otherwise that many literal cells
+};
+
+struct sSpriteFileHeader
+{
+	char magic[4];					// "CSPR"
+	unsigned short nVersion;
+	unsigned short nPixelFormat;
+	unsigned short nWidth;
+	unsigned short nHeight;
+	unsigned short nCompression;
+	unsigned short nReserved;
+	unsigned int nPayloadSize;
+	unsigned int nCrc;				// CRC-32 of the payload as stored
+	unsigned int nReserved2[2];
+};
+
+static_assert(sizeof(sSpriteFileHeader) == 32, "sprite header must stay 32 bytes");
+static_assert(sizeof(CHAR_INFO) == 4, "sprite cells are stored as 4 byte CHAR_INFO");
+
+// Opaque cells [x1, x2) of one sprite row
+struct sSpriteSpan
+{
+	unsigned short x1, x2;
+};
+
 class Sprite
 {
 private:
-	short* spriteData;
+	static constexpr unsigned short VERSION = 1;
+
+	const CHAR_INFO* spriteData;
+	std::vector<CHAR_INFO> vecOwnedData;	// decompressed or converted cells, empty when spriteData points into the view
+	void* pView;
 	int nSpriteDimX, nSpriteDimY;
 
+	// Opaque spans of every row, row y's are [vecRowSpans[y], vecRowSpans[y + 1])
+	std::vector<sSpriteSpan> vecSpans;
+	std::vector<int> vecRowSpans;
+	short nTransparentColor;
+
+	void BuildSpans()
+	{
+		vecSpans.clear();
+		vecRowSpans.assign(1, 0);
+		for (int y = 0; y < nSpriteDimY; y++)
+		{
+			const CHAR_INFO* row = spriteData + y * nSpriteDimX;
+			int x = 0;
+			while (x < nSpriteDimX)
+			{
+				while (x < nSpriteDimX && row[x].Attributes == (WORD)nTransparentColor)
+					x++;
+				int x1 = x;
+				while (x < nSpriteDimX && row[x].Attributes != (WORD)nTransparentColor)
+					x++;
+				if (x > x1)
+					vecSpans.push_back({ (unsigned short)x1, (unsigned short)x });
+			}
+			vecRowSpans.push_back((int)vecSpans.size());
+		}
+	}
+
+	static unsigned int Crc32(const unsigned char* data, size_t nSize)
+	{
+		static const auto table = [] {
+			std::vector<unsigned int> t(256);
+			for (unsigned int i = 0; i < 256; i++)
+			{
+				unsigned int c = i;
+				for (int k = 0; k < 8; k++)
+					c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+				t[i] = c;
+			}
+			return t;
+		}();
+
+		unsigned int crc = 0xFFFFFFFFu;
+		for (size_t i = 0; i < nSize; i++)
+			crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+		return crc ^ 0xFFFFFFFFu;
+	}
+
+	static bool Unpack(const unsigned char* data, size_t nSize, CHAR_INFO* cells, size_t nCells)
+	{
+		size_t i = 0, n = 0;
+		while (i + sizeof(unsigned short) <= nSize)
+		{
+			unsigned short nPacket;
+			memcpy(&nPacket, data + i, sizeof(nPacket));
+			i += sizeof(nPacket);
+
+			size_t nCount = nPacket & 0x7FFF;
+			size_t nBytes = nPacket & 0x8000 ? sizeof(CHAR_INFO) : nCount * sizeof(CHAR_INFO);
+			if (nCount == 0 || n + nCount > nCells || i + nBytes > nSize)
+				return false;
+
+			if (nPacket & 0x8000)
+			{
+				CHAR_INFO cell;
+				memcpy(&cell, data + i, sizeof(cell));
+				std::fill(cells + n, cells + n + nCount, cell);
+			}
+			else
+				memcpy(cells + n, data + i, nBytes);
+
+			i += nBytes;
+			n += nCount;
+		}
+
+		return i == nSize && n == nCells;
+	}
+
+	static std::vector<unsigned char> Pack(const CHAR_INFO* cells, size_t nCells)
+	{
+		auto Same = [&](size_t a, size_t b) { return memcmp(cells + a, cells + b, sizeof(CHAR_INFO)) == 0; };
+
+		std::vector<unsigned char> vecOut;
+		auto Append = [&](const void* p, size_t nBytes) {
+			vecOut.insert(vecOut.end(), (const unsigned char*)p, (const unsigned char*)p + nBytes);
+		};
+
+		size_t i = 0;
+		while (i < nCells)
+		{
+			size_t nRun = 1;
+			while (i + nRun < nCells && nRun < 0x7FFF && Same(i, i + nRun))
+				nRun++;
+
+			if (nRun >= 2)
+			{
+				unsigned short nPacket = (unsigned short)(0x8000 | nRun);
+				Append(&nPacket, sizeof(nPacket));
+				Append(cells + i, sizeof(CHAR_INFO));
+				i += nRun;
+				continue;
+			}
+
+			// Literals until the next run of two
+			size_t nCount = 1;
+			while (i + nCount < nCells && nCount < 0x7FFF && !(i + nCount + 1 < nCells && Same(i + nCount, i + nCount + 1)))
+				nCount++;
+
+			unsigned short nPacket = (unsigned short)nCount;
+			Append(&nPacket, sizeof(nPacket));
+			Append(cells + i, nCount * sizeof(CHAR_INFO));
+			i += nCount;
+		}
+
+		return vecOut;
+	}
+
+	// Old sprites: the writer used text mode, so every 0x0A byte went out as 0x0D 0x0A
+	bool LoadLegacy(const unsigned char* data, size_t nSize)
+	{
+		std::vector<unsigned char> vecBytes;
+		vecBytes.reserve(nSize);
+		for (size_t i = 0; i < nSize; i++)
+		{
+			if (!(data[i] == 0x0D && i + 1 < nSize && data[i + 1] == 0x0A))
+				vecBytes.push_back(data[i]);
+		}
+
+		int nDimX, nDimY;
+		if (vecBytes.size() < 2 * sizeof(int))
+			return false;
+		memcpy(&nDimX, vecBytes.data(), sizeof(int));
+		memcpy(&nDimY, vecBytes.data() + sizeof(int), sizeof(int));
+
+		if (nDimX <= 0 || nDimY <= 0 || nDimX > 0xFFFF || nDimY > 0xFFFF ||
+			vecBytes.size() - 2 * sizeof(int) < (size_t)nDimX * nDimY * sizeof(short))
+			return false;
+
+		vecOwnedData.resize((size_t)nDimX * nDimY);
+		for (size_t i = 0; i < vecOwnedData.size(); i++)
+		{
+			short color;
+			memcpy(&color, vecBytes.data() + 2 * sizeof(int) + i * sizeof(short), sizeof(short));
+			vecOwnedData[i].Char.UnicodeChar = PIXEL_SOLID;
+			vecOwnedData[i].Attributes = color;
+		}
+
+		spriteData = vecOwnedData.data();
+		nSpriteDimX = nDimX;
+		nSpriteDimY = nDimY;
+		return true;
+	}
+
+	bool LoadView(const unsigned char* data, size_t nSize)
+	{
+		sSpriteFileHeader header;
+		if (nSize < sizeof(header) || memcmp(data, "CSPR", 4) != 0)
+			return LoadLegacy(data, nSize);
+
+		memcpy(&header, data, sizeof(header));
+		size_t nCells = (size_t)header.nWidth * header.nHeight;
+		const unsigned char* payload = data + sizeof(header);
+
+		if (header.nVersion != VERSION || header.nPixelFormat != SPRITE_PIXEL_CHAR_INFO || nCells == 0 ||
+			header.nPayloadSize > nSize - sizeof(header) || Crc32(payload, header.nPayloadSize) != header.nCrc)
+			return false;
+
+		if (header.nCompression == SPRITE_COMPRESSION_NONE)
+		{
+			if (header.nPayloadSize != nCells * sizeof(CHAR_INFO))
+				return false;
+			spriteData = (const CHAR_INFO*)payload;
+		}
+		else if (header.nCompression == SPRITE_COMPRESSION_RLE)
+		{
+			vecOwnedData.resize(nCells);
+			if (!Unpack(payload, header.nPayloadSize, vecOwnedData.data(), nCells))
+				return false;
+			spriteData = vecOwnedData.data();
+		}
+		else
+			return false;
+
+		nSpriteDimX = header.nWidth;
+		nSpriteDimY = header.nHeight;
+		return true;
+	}
+
 public:
 	cf::vec_2d<float> vPos;
 
@@ -100,39 +335,153 @@ public:
 	{
 		nSpriteDimX = nSpriteDimY = 0;
 		spriteData = nullptr;
+		pView = nullptr;
+		nTransparentColor = FG_BLACK | BG_BLACK;
 	}
 
+	// The cells may live in a mapped view of the file
+	Sprite(const Sprite&) = delete;
+	Sprite& operator=(const Sprite&) = delete;
+
+	// Maps the file and uses its cells in place when it's stored uncompressed
 	bool Load(std::string sFile)
 	{
-		FILE* f = nullptr;
-		fopen_s(&f, sFile.c_str(), "r");
+		Release();
 
-		if (!f)
+		HANDLE hFile = CreateFileA(sFile.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (hFile == INVALID_HANDLE_VALUE)
 			return false;
 
-		fread(&nSpriteDimX, sizeof(int), 1, f);
-		fread(&nSpriteDimY, sizeof(int), 1, f);
+		LARGE_INTEGER nFileSize;
+		if (!GetFileSizeEx(hFile, &nFileSize) || nFileSize.QuadPart == 0 || nFileSize.QuadPart > 0x7FFFFFFF)
+		{
+			CloseHandle(hFile);
+			return false;
+		}
 
-		spriteData = new short[nSpriteDimX * nSpriteDimY];
+		// The view keeps the mapping and the file open after the handles are closed
+		HANDLE hMapping = CreateFileMappingA(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (hMapping)
+		{
+			pView = MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+			CloseHandle(hMapping);
+		}
+		CloseHandle(hFile);
 
-		fread(spriteData, sizeof(short), nSpriteDimX * nSpriteDimY, f);
+		if (!pView || !LoadView((const unsigned char*)pView, (size_t)nFileSize.QuadPart))
+		{
+			Release();
+			return false;
+		}
 
+		// Nothing points into the file any more
+		if (spriteData != (const CHAR_INFO*)((const unsigned char*)pView + sizeof(sSpriteFileHeader)))
+		{
+			UnmapViewOfFile(pView);
+			pView = nullptr;
+		}
+
+		BuildSpans();
 		return true;
 	}
 
+	// Copies the cells out of the mapped view and closes it. Windows won't
+	// truncate a file while a view of it is open
+	void Detach()
+	{
+		if (!pView)
+			return;
+
+		vecOwnedData.assign(spriteData, spriteData + (size_t)nSpriteDimX * nSpriteDimY);
+		spriteData = vecOwnedData.data();
+		UnmapViewOfFile(pView);
+		pView = nullptr;
+	}
+
+	// A sprite drawn from its mapped file is detached from it first, so it can
+	// be saved back over the file it was loaded from
+	bool Save(std::string sFile, bool bCompress = true)
+	{
+		if (!spriteData)
+			return false;
+
+		Detach();
+
+		size_t nCells = (size_t)nSpriteDimX * nSpriteDimY;
+		std::vector<unsigned char> vecPayload;
+		if (bCompress)
+			vecPayload = Pack(spriteData, nCells);
+
+		// Packing only pays off for sprites with runs in them
+		if (!bCompress || vecPayload.size() >= nCells * sizeof(CHAR_INFO))
+			vecPayload.assign((const unsigned char*)spriteData, (const unsigned char*)(spriteData + nCells));
+
+		sSpriteFileHeader header = {};
+		memcpy(header.magic, "CSPR", 4);
+		header.nVersion = VERSION;
+		header.nPixelFormat = SPRITE_PIXEL_CHAR_INFO;
+		header.nWidth = (unsigned short)nSpriteDimX;
+		header.nHeight = (unsigned short)nSpriteDimY;
+		header.nCompression = vecPayload.size() < nCells * sizeof(CHAR_INFO) ? SPRITE_COMPRESSION_RLE : SPRITE_COMPRESSION_NONE;
+		header.nPayloadSize = (unsigned int)vecPayload.size();
+		header.nCrc = Crc32(vecPayload.data(), vecPayload.size());
+
+		FILE* f = nullptr;
+		fopen_s(&f, sFile.c_str(), "wb");
+
+		if (!f)
+			return false;
+
+		bool bWritten = fwrite(&header, sizeof(header), 1, f) == 1 &&
+			fwrite(vecPayload.data(), 1, vecPayload.size(), f) == vecPayload.size();
+
+		return fclose(f) == 0 && bWritten;
+	}
+
+	void Release()
+	{
+		if (pView)
+			UnmapViewOfFile(pView);
+		pView = nullptr;
+		spriteData = nullptr;
+		vecOwnedData.clear();
+		vecSpans.clear();
+		vecRowSpans.clear();
+		nSpriteDimX = nSpriteDimY = 0;
+	}
+
 	cf::vec_2d<int> GetSpriteDim() const
 	{
 		return cf::vec_2d{ nSpriteDimX , nSpriteDimY };
 	}
 
+	const CHAR_INFO* GetCells() const
+	{
+		return spriteData;
+	}
+
+	// Cells with these attributes are skipped by transparent draws, black on black by default
+	void SetTransparentColor(short color)
+	{
+		nTransparentColor = color;
+		if (spriteData)
+			BuildSpans();
+	}
+
+	const sSpriteSpan* GetRowSpans(int y, int& nCount) const
+	{
+		nCount = vecRowSpans[y + 1] - vecRowSpans[y];
+		return vecSpans.data() + vecRowSpans[y];
+	}
+
 	short operator[](int x) const
 	{
-		return spriteData[x];
+		return spriteData[x].Attributes;
 	}
 
 	~Sprite()
 	{
-		delete[] spriteData;
+		Release();
 	}
 };
 
@@ -640,22 +989,56 @@ public:
 		}
 	}
 	
-	void DrawSprite(Sprite& sprite)
+	// Copies the sprite's cells [srcX, srcX + w) x [srcY, srcY + h) to (x, y). The rectangle is clipped
+	// once against the sprite and the screen, then whole rows are copied, or only their opaque spans
+	// when drawing with transparency
+	void DrawSprite(const Sprite& sprite, int x, int y, int srcX, int srcY, int w, int h, bool bTransparent = false)
 	{
-		int x, y;
-		int nDimX, nDimY;
-		nDimX = sprite.GetSpriteDim().x;
-		nDimY = sprite.GetSpriteDim().y;
+		const CHAR_INFO* cells = sprite.GetCells();
+		if (!cells)
+			return;
+
+		int nDimX = sprite.GetSpriteDim().x;
+		int nDimY = sprite.GetSpriteDim().y;
+
+		if (srcX < 0) { x -= srcX; w += srcX; srcX = 0; }
+		if (srcY < 0) { y -= srcY; h += srcY; srcY = 0; }
+		if (x < 0) { srcX -= x; w += x; x = 0; }
+		if (y < 0) { srcY -= y; h += y; y = 0; }
+		w = min(w, min(nDimX - srcX, m_screenWidth - x));
+		h = min(h, min(nDimY - srcY, m_screenHeight - y));
 
-		for (y = 0; y < nDimY; y++)
+		if (w <= 0 || h <= 0)
+			return;
+
+		for (int row = 0; row < h; row++)
 		{
-			for (x = 0; x < nDimX; x++)
+			const CHAR_INFO* src = cells + (srcY + row) * nDimX;
+			CHAR_INFO* dst = m_bufScreenData + (y + row) * m_screenWidth + x;
+
+			if (!bTransparent)
+			{
+				memcpy(dst, src + srcX, w * sizeof(CHAR_INFO));
+				continue;
+			}
+
+			int nSpans;
+			const sSpriteSpan* spans = sprite.GetRowSpans(srcY + row, nSpans);
+			for (int i = 0; i < nSpans && spans[i].x1 < srcX + w; i++)
 			{
-				Pixelate({ x + (int)sprite.vPos.x , y + (int)sprite.vPos.y }, sprite[y * nDimX + x]);
+				int x1 = max((int)spans[i].x1, srcX);
+				int x2 = min((int)spans[i].x2, srcX + w);
+				if (x1 < x2)
+					memcpy(dst + x1 - srcX, src + x1, (x2 - x1) * sizeof(CHAR_INFO));
 			}
 		}
 	}
 
+	void DrawSprite(const Sprite& sprite, bool bTransparent = false)
+	{
+		DrawSprite(sprite, (int)sprite.vPos.x, (int)sprite.vPos.y, 0, 0, sprite.GetSpriteDim().x, sprite.GetSpriteDim().y, bTransparent);
+	}
+
 	void Clip(int& x, int& y) const
 	{
 		if (x < 0) x = 0;